@@ -0,0 +1,49 @@
+//
+// Adds and removes a component on 200k entities, moving each one in and out of a two-component system.
+// Build from the repository root:
+//     g++ -std=c++20 -O2 -DNDEBUG bench/add_remove.cpp -o add_remove -pthread
+// Add -DQV_ARCHETYPE_STORAGE to measure archetype storage instead.
+//
+
+#include "../quiver.h"
+#include <chrono>
+#include <cstdio>
+
+struct Transform { float x, y, z; };
+struct Velocity { float x, y, z; };
+
+struct MovementSystem : qv::System<Transform, Velocity> {};
+
+using Clock = std::chrono::steady_clock;
+
+int main() {
+    constexpr size_t entityCount = 200'000;
+    constexpr int rounds = 5;
+
+    qv::World::registerComponent<Transform, Velocity>();
+    MovementSystem::registerSystem();
+
+    std::vector<qv::EntityHandle> handles;
+    handles.reserve(entityCount);
+    for (size_t i = 0; i < entityCount; i++) {
+        handles.push_back(qv::World::createEntity());
+        qv::World::addComponent<Transform>(handles.back());
+    }
+
+    double addNs = 0, removeNs = 0;
+    for (int round = 0; round < rounds; round++) {
+        auto start = Clock::now();
+        for (auto handle : handles) qv::World::addComponent<Velocity>(handle);
+        auto added = Clock::now();
+        for (auto handle : handles) qv::World::removeComponent<Velocity>(handle);
+        auto removed = Clock::now();
+
+        addNs += std::chrono::duration<double, std::nano>(added - start).count();
+        removeNs += std::chrono::duration<double, std::nano>(removed - added).count();
+    }
+
+    constexpr double operations = double(entityCount) * rounds;
+    std::printf("addComponent    %.1f ns/op\n", addNs / operations);
+    std::printf("removeComponent %.1f ns/op\n", removeNs / operations);
+    std::printf("combined        %.1f ns/op\n", (addNs + removeNs) / (2 * operations));
+}
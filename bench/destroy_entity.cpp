@@ -0,0 +1,55 @@
+//
+// Destroys 100k entities that each have 8 components and belong to 4 systems.
+// Build from the repository root:
+//     g++ -std=c++20 -O2 -DNDEBUG bench/destroy_entity.cpp -o destroy_entity -pthread
+// Add -DQV_ARCHETYPE_STORAGE to measure archetype storage instead.
+//
+
+#include "../quiver.h"
+#include <chrono>
+#include <cstdio>
+
+template<size_t N>
+struct Component { int value; };
+
+struct FirstSystem : qv::System<Component<0>, Component<1>> {};
+struct SecondSystem : qv::System<Component<2>, Component<3>> {};
+struct ThirdSystem : qv::System<Component<4>, Component<5>, Component<6>> {};
+struct FourthSystem : qv::System<Component<7>> {};
+
+using Clock = std::chrono::steady_clock;
+
+template<size_t... Ns>
+static void addComponents(qv::EntityHandle handle, std::index_sequence<Ns...>) {
+    (qv::World::addComponent<Component<Ns>>(handle), ...);
+}
+
+int main() {
+    constexpr size_t entityCount = 100'000;
+    constexpr int rounds = 5;
+
+    [] <size_t... Ns> (std::index_sequence<Ns...>) {
+        qv::World::registerComponent<Component<Ns>...>();
+    }(std::make_index_sequence<8>{});
+    FirstSystem::registerSystem();
+    SecondSystem::registerSystem();
+    ThirdSystem::registerSystem();
+    FourthSystem::registerSystem();
+
+    double totalNs = 0;
+    std::vector<qv::EntityHandle> handles;
+    handles.reserve(entityCount);
+    for (int round = 0; round < rounds; round++) {
+        handles.clear();
+        for (size_t i = 0; i < entityCount; i++) {
+            handles.push_back(qv::World::createEntity());
+            addComponents(handles.back(), std::make_index_sequence<8>{});
+        }
+
+        auto start = Clock::now();
+        for (auto handle : handles) qv::World::destroyEntity(handle);
+        totalNs += std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    }
+
+    std::printf("destroyEntity (8 components, 4 systems) %.1f ns\n", totalNs / double(entityCount * rounds));
+}
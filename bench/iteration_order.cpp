@@ -0,0 +1,89 @@
+//
+// Iterates a system of 1M entities after its order has been scrambled by toggling a tag component.
+// Build from the repository root:
+//     g++ -std=c++20 -O2 -DNDEBUG bench/iteration_order.cpp -o iteration_order -pthread
+// Add -DQV_ARCHETYPE_STORAGE to measure archetype storage instead.
+//
+
+#include "../quiver.h"
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+struct Transform { float matrix[16]{}; };
+struct Velocity { float v[4]{1, 1, 1, 1}; };
+struct Sleeping {};
+
+struct MovementSystem : qv::System<Transform, Velocity, qv::Without<Sleeping>> {};
+
+using Clock = std::chrono::steady_clock;
+
+static double millisecondsSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static void integrate() {
+    for (auto& [transform, velocity, handle] : MovementSystem::getComponents()) {
+        for (int i = 0; i < 4; i++) transform.matrix[12 + i] += velocity.v[i];
+    }
+}
+
+static void toggleSleeping(qv::EntityHandle handle) {
+    qv::World::addComponent<Sleeping>(handle);
+    qv::World::removeComponent<Sleeping>(handle);
+}
+
+int main() {
+    constexpr size_t entityCount = 1'000'000;
+
+    qv::World::registerComponent<Transform, Velocity, Sleeping>();
+    MovementSystem::registerSystem();
+
+    std::vector<qv::EntityHandle> handles;
+    handles.reserve(entityCount);
+    for (size_t i = 0; i < entityCount; i++) {
+        auto handle = qv::World::createEntity();
+        qv::World::addComponent<Transform>(handle);
+        qv::World::addComponent<Velocity>(handle);
+        handles.push_back(handle);
+    }
+
+    // Toggling the tag moves entities out of the system and back in, without touching the component pools
+    std::mt19937 rng(1);
+    for (size_t i = 0; i < entityCount / 2; i++) toggleSleeping(handles[rng() % entityCount]);
+
+    auto start = Clock::now();
+    auto& list = MovementSystem::getComponents();
+    double firstAccess = millisecondsSince(start);
+
+    // Consecutive tuples whose Transform is adjacent in memory, a rough proxy for cache misses
+    size_t sequential = 0;
+    for (size_t i = 1; i < list.size(); i++) {
+        auto* previous = &std::get<0>(list[i - 1]);
+        sequential += &std::get<0>(list[i]) == previous + 1;
+    }
+
+    double bestIteration = 1e9;
+    for (int run = 0; run < 10; run++) {
+        start = Clock::now();
+        integrate();
+        bestIteration = std::min(bestIteration, millisecondsSince(start));
+    }
+
+    start = Clock::now();
+    for (int frame = 0; frame < 100; frame++) {
+        for (int i = 0; i < 1000; i++) toggleSleeping(handles[rng() % entityCount]);
+        integrate();
+    }
+    double frames = millisecondsSince(start);
+
+    float checksum = 0;
+    for (auto& [transform, velocity, handle] : MovementSystem::getComponents()) checksum += transform.matrix[12];
+
+    std::printf("entities                        %zu\n", list.size());
+    std::printf("sequential Transform neighbours %.1f%%\n", 100.0 * sequential / std::max<size_t>(1, list.size() - 1));
+    std::printf("first getComponents             %.2f ms\n", firstAccess);
+    std::printf("iteration (best of 10)          %.2f ms\n", bestIteration);
+    std::printf("100 frames, 1000 toggles each   %.2f ms\n", frames);
+    std::printf("checksum                        %g\n", checksum);
+}
@@ -0,0 +1,54 @@
+//
+// Reserves 1M entity handles from 1 to 64 pool threads, one at a time and in blocks, then materializes them.
+// Build from the repository root:
+//     g++ -std=c++20 -O2 -DNDEBUG bench/reserve_scaling.cpp -o reserve_scaling -pthread
+// Thread counts above the machine's core count are time-sliced and show no further scaling.
+//
+
+#include "../quiver.h"
+#include <chrono>
+#include <cstdio>
+
+struct Position { float x, y; };
+
+using Clock = std::chrono::steady_clock;
+
+static double nanosecondsPer(Clock::time_point start, Clock::time_point end, size_t count) {
+    return std::chrono::duration<double, std::nano>(end - start).count() / double(count);
+}
+
+int main() {
+    constexpr size_t entityCount = 1 << 20;
+    constexpr size_t grainSize = 4096;
+
+    qv::World::registerComponent<Position>();
+
+    std::printf("threads  mode    reserve ns/entity  materialize ns/entity\n");
+    for (size_t threads : {1, 2, 4, 8, 16, 32, 64}) {
+        qv::ThreadPool pool{threads};
+
+        for (bool blocks : {false, true}) {
+            auto start = Clock::now();
+            pool.parallelFor(entityCount, grainSize, [&](size_t begin, size_t end) {
+                if (blocks) {
+                    thread_local std::vector<qv::EntityHandle> block;
+                    block.resize(end - begin);
+                    qv::World::reserveEntities(block);
+                } else {
+                    for (size_t i = begin; i < end; i++) (void)qv::World::reserveEntity();
+                }
+            });
+            auto reserved = Clock::now();
+            qv::World::flush();
+            auto materialized = Clock::now();
+
+            std::printf("%7zu  %-6s  %17.2f  %21.2f\n", threads, blocks ? "block" : "single",
+                        nanosecondsPer(start, reserved, entityCount),
+                        nanosecondsPer(reserved, materialized, entityCount));
+        }
+    }
+
+    auto start = Clock::now();
+    for (size_t i = 0; i < entityCount; i++) (void)qv::World::createEntity();
+    std::printf("serial createEntity %.2f ns/entity\n", nanosecondsPer(start, Clock::now(), entityCount));
+}
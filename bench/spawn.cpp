@@ -0,0 +1,50 @@
+//
+// Spawns increasing numbers of entities into a two-component system; the time per entity should stay flat.
+// Build from the repository root:
+//     g++ -std=c++20 -O2 -DNDEBUG bench/spawn.cpp -o spawn -pthread
+// Pass entity counts as arguments to override the default sizes.
+//
+
+#include "../quiver.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+struct Transform { float x, y, z; };
+struct Velocity { float x, y, z; };
+
+struct MovementSystem : qv::System<Transform, Velocity> {};
+
+using Clock = std::chrono::steady_clock;
+
+int main(int argc, char** argv) {
+    std::vector<size_t> counts{25'000, 50'000, 100'000, 200'000, 400'000};
+    if (argc > 1) {
+        counts.clear();
+        for (int i = 1; i < argc; i++) counts.push_back(std::strtoull(argv[i], nullptr, 10));
+    }
+
+    qv::World::registerComponent<Transform, Velocity>();
+    MovementSystem::registerSystem();
+
+    std::printf("entities  spawn ms  ns/entity  destroy ms\n");
+    for (size_t count : counts) {
+        std::vector<qv::EntityHandle> handles;
+        handles.reserve(count);
+
+        auto start = Clock::now();
+        for (size_t i = 0; i < count; i++) {
+            auto handle = qv::World::createEntity();
+            qv::World::addComponent<Transform>(handle);
+            qv::World::addComponent<Velocity>(handle);
+            handles.push_back(handle);
+        }
+        auto spawned = Clock::now();
+        for (auto handle : handles) qv::World::destroyEntity(handle);
+        auto destroyed = Clock::now();
+
+        double spawnMs = std::chrono::duration<double, std::milli>(spawned - start).count();
+        std::printf("%8zu  %8.2f  %9.1f  %10.2f\n", count, spawnMs, spawnMs * 1e6 / double(count),
+                    std::chrono::duration<double, std::milli>(destroyed - spawned).count());
+    }
+}
@@ -6,207 +6,2498 @@
 #define QUIVER_QUIVER_H
 
 #include <iostream>
-#include <functional>
 #include <vector>
-#include <map>
-#include <set>
-#include <bitset>
+#include <deque>
+#include <unordered_map>
 #include <cassert>
 #include <ranges>
 #include <algorithm>
+#include <memory>
+#include <array>
+#include <limits>
+#include <bit>
+#include <span>
+#include <optional>
+#include <cstdint>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <numeric>
+#include <utility>
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    #include <arm_neon.h>
+#endif
 
 #ifdef QV_DEBUG_VERBOSE
     #define QV_DEBUG
 #endif
 
-namespace qv {
+namespace qv {
+
+    // Component IDs below this are stored inline in signatures, higher ones overflow to the heap
+#ifdef QV_COMPONENT_BITSET_SIZE
+    constexpr size_t componentBitsetSize = QV_COMPONENT_BITSET_SIZE;
+#else
+    constexpr size_t componentBitsetSize = 64;
+#endif
+
+    // Bitset over component IDs. The first InlineBits bits live inline, and higher IDs spill into a heap overflow that
+    // is kept trimmed of trailing zero words, so signatures only using low IDs never allocate and compare by value
+    template<size_t InlineBits>
+    class Signature {
+    public:
+        using Word = uint64_t;
+        static constexpr size_t wordBits = 64;
+        static constexpr size_t inlineWords = (InlineBits + wordBits - 1) / wordBits;
+
+        constexpr Signature& set(size_t bit) {
+            auto index = bit / wordBits;
+            if (index < inlineWords) {
+                words[index] |= mask(bit);
+                return *this;
+            }
+
+            index -= inlineWords;
+            if (index >= overflow.size()) {
+                overflow.resize(index + 1);
+            }
+            overflow[index] |= mask(bit);
+            return *this;
+        }
+
+        constexpr Signature& reset(size_t bit) {
+            auto index = bit / wordBits;
+            if (index < inlineWords) {
+                words[index] &= ~mask(bit);
+            } else if (index - inlineWords < overflow.size()) {
+                overflow[index - inlineWords] &= ~mask(bit);
+                trim();
+            }
+            return *this;
+        }
+
+        constexpr Signature& reset() {
+            words = {};
+            overflow.clear();
+            return *this;
+        }
+
+        [[nodiscard]] constexpr bool test(size_t bit) const {
+            return word(bit / wordBits) & mask(bit);
+        }
+
+        // Number of bits currently stored, every bit at or past it is unset
+        [[nodiscard]] constexpr size_t size() const {
+            return wordCount() * wordBits;
+        }
+
+        [[nodiscard]] constexpr size_t wordCount() const {
+            return inlineWords + overflow.size();
+        }
+
+        // Words past wordCount() read as zero
+        [[nodiscard]] constexpr Word word(size_t index) const {
+            if (index < inlineWords) return words[index];
+            index -= inlineWords;
+            return index < overflow.size() ? overflow[index] : 0;
+        }
+
+        [[nodiscard]] constexpr bool none() const {
+            return overflow.empty() && std::ranges::all_of(words, [](Word word) { return word == 0; });
+        }
+
+        [[nodiscard]] constexpr bool any() const {
+            return !none();
+        }
+
+        // True when every bit set in other is also set here. Accumulates missing bits without early exits so the
+        // inline loop compiles to straight-line vector code
+        [[nodiscard]] constexpr bool contains(const Signature& other) const {
+            if (other.overflow.size() > overflow.size()) return false;
+
+            Word missing = 0;
+            for (size_t index = 0; index < inlineWords; index++) {
+                missing |= other.words[index] & ~words[index];
+            }
+            for (size_t index = 0; index < other.overflow.size(); index++) {
+                missing |= other.overflow[index] & ~overflow[index];
+            }
+            return missing == 0;
+        }
+
+        [[nodiscard]] constexpr bool intersects(const Signature& other) const {
+            Word common = 0;
+            for (size_t index = 0; index < inlineWords; index++) {
+                common |= other.words[index] & words[index];
+            }
+            for (size_t index = 0; index < std::min(overflow.size(), other.overflow.size()); index++) {
+                common |= other.overflow[index] & overflow[index];
+            }
+            return common != 0;
+        }
+
+        // Calls function(bit) for each set bit in ascending order
+        template<typename Function>
+        constexpr void forEachBit(Function&& function) const {
+            for (size_t index = 0; index < wordCount(); index++) {
+                for (auto bits = word(index); bits != 0; bits &= bits - 1) {
+                    function(index * wordBits + std::countr_zero(bits));
+                }
+            }
+        }
+
+        constexpr Signature operator&(const Signature& other) const {
+            Signature result;
+            for (size_t index = 0; index < inlineWords; index++) {
+                result.words[index] = words[index] & other.words[index];
+            }
+
+            result.overflow.resize(std::min(overflow.size(), other.overflow.size()));
+            for (size_t index = 0; index < result.overflow.size(); index++) {
+                result.overflow[index] = overflow[index] & other.overflow[index];
+            }
+            result.trim();
+            return result;
+        }
+
+        constexpr Signature operator|(const Signature& other) const {
+            Signature result;
+            for (size_t index = 0; index < inlineWords; index++) {
+                result.words[index] = words[index] | other.words[index];
+            }
+
+            result.overflow.resize(std::max(overflow.size(), other.overflow.size()));
+            for (size_t index = 0; index < result.overflow.size(); index++) {
+                result.overflow[index] = word(inlineWords + index) | other.word(inlineWords + index);
+            }
+            return result;
+        }
+
+        bool operator==(const Signature&) const = default;
+
+        struct Hash {
+            size_t operator()(const Signature& signature) const {
+                size_t hash = 0;
+                for (size_t index = 0; index < signature.wordCount(); index++) {
+                    hash = hash * 31 + std::hash<Word>{}(signature.word(index));
+                }
+                return hash;
+            }
+        };
+    private:
+        static constexpr Word mask(size_t bit) {
+            return Word{1} << (bit % wordBits);
+        }
+
+        constexpr void trim() {
+            while (!overflow.empty() && overflow.back() == 0) {
+                overflow.pop_back();
+            }
+        }
+
+        std::array<Word, inlineWords> words{};
+        std::vector<Word> overflow;
+    };
+
+    using ComponentSignature = Signature<componentBitsetSize>;
+
+    // Pairs of required and excluded signatures stored word-major, so one entity signature can be tested against a
+    // whole block of them at once with AVX2 or NEON, or a plain loop the compiler can vectorize otherwise. Rows are
+    // padded to a multiple of the block width with empty signatures, which are masked out of the results
+    class SignatureMatrix {
+    public:
+        using Word = ComponentSignature::Word;
+
+#if defined(__AVX2__)
+        static constexpr size_t blockWidth = 4;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        static constexpr size_t blockWidth = 2;
+#else
+        static constexpr size_t blockWidth = 4;
+#endif
+
+        // A row matches signatures containing every bit of required and none of excluded
+        void push_back(const ComponentSignature& required, const ComponentSignature& excluded = {}) {
+            requiredRows.push_back(required);
+            excludedRows.push_back(excluded);
+
+            stride = (requiredRows.size() + blockWidth - 1) / blockWidth * blockWidth;
+            requiredWords = transpose(requiredRows, requiredWordCount);
+            excludedWords = transpose(excludedRows, excludedWordCount);
+        }
+
+        // Calls function(row) for every row matching signature, in ascending order
+        template<typename Function>
+        void match(const ComponentSignature& signature, Function&& function) const {
+            for (size_t base = 0; base < size(); base += blockWidth) {
+                auto matches = matchBlock(signature, base);
+                if (size() - base < blockWidth) {
+                    matches &= (1u << (size() - base)) - 1;
+                }
+
+                for (; matches != 0; matches &= matches - 1) {
+                    function(base + std::countr_zero(matches));
+                }
+            }
+        }
+
+        [[nodiscard]] size_t size() const {
+            return requiredRows.size();
+        }
+    private:
+        // Lays signatures out word-major, count is set to the most words any of them uses, so a matrix without any
+        // exclusions has no excluded words to test
+        std::vector<Word> transpose(const std::vector<ComponentSignature>& signatures, size_t& count) const {
+            count = std::ranges::max(signatures | std::views::transform([](const ComponentSignature& signature) {
+                return signature.none() ? 0 : signature.wordCount();
+            }));
+
+            std::vector<Word> result(stride * count, 0);
+            for (size_t row = 0; row < signatures.size(); row++) {
+                for (size_t word = 0; word < count; word++) {
+                    result[word * stride + row] = signatures[row].word(word);
+                }
+            }
+            return result;
+        }
+
+        // Bit i of the result is set when row base + i matches
+        [[nodiscard]] unsigned matchBlock(const ComponentSignature& signature, size_t base) const {
+#if defined(__AVX2__)
+            auto missing = _mm256_setzero_si256();
+            for (size_t word = 0; word < requiredWordCount; word++) {
+                auto absent = _mm256_set1_epi64x(static_cast<long long>(~signature.word(word)));
+                auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&requiredWords[word * stride + base]));
+                missing = _mm256_or_si256(missing, _mm256_and_si256(block, absent));
+            }
+            for (size_t word = 0; word < excludedWordCount; word++) {
+                auto present = _mm256_set1_epi64x(static_cast<long long>(signature.word(word)));
+                auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&excludedWords[word * stride + base]));
+                missing = _mm256_or_si256(missing, _mm256_and_si256(block, present));
+            }
+
+            auto matched = _mm256_cmpeq_epi64(missing, _mm256_setzero_si256());
+            return static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(matched)));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+            auto missing = vdupq_n_u64(0);
+            for (size_t word = 0; word < requiredWordCount; word++) {
+                auto absent = vdupq_n_u64(~signature.word(word));
+                auto block = vld1q_u64(&requiredWords[word * stride + base]);
+                missing = vorrq_u64(missing, vandq_u64(block, absent));
+            }
+            for (size_t word = 0; word < excludedWordCount; word++) {
+                auto present = vdupq_n_u64(signature.word(word));
+                auto block = vld1q_u64(&excludedWords[word * stride + base]);
+                missing = vorrq_u64(missing, vandq_u64(block, present));
+            }
+
+            auto matched = vceqzq_u64(missing);
+            return (vgetq_lane_u64(matched, 0) & 1u) | (vgetq_lane_u64(matched, 1) & 2u);
+#else
+            std::array<Word, blockWidth> missing{};
+            for (size_t word = 0; word < requiredWordCount; word++) {
+                auto absent = ~signature.word(word);
+                for (size_t lane = 0; lane < blockWidth; lane++) {
+                    missing[lane] |= requiredWords[word * stride + base + lane] & absent;
+                }
+            }
+            for (size_t word = 0; word < excludedWordCount; word++) {
+                auto present = signature.word(word);
+                for (size_t lane = 0; lane < blockWidth; lane++) {
+                    missing[lane] |= excludedWords[word * stride + base + lane] & present;
+                }
+            }
+
+            unsigned matched = 0;
+            for (size_t lane = 0; lane < blockWidth; lane++) {
+                matched |= static_cast<unsigned>(missing[lane] == 0) << lane;
+            }
+            return matched;
+#endif
+        }
+
+        std::vector<ComponentSignature> requiredRows;
+        std::vector<ComponentSignature> excludedRows;
+        std::vector<Word> requiredWords; // requiredWords[word * stride + row]
+        std::vector<Word> excludedWords;
+        size_t stride = 0;
+        size_t requiredWordCount = 0;
+        size_t excludedWordCount = 0;
+    };
+
+#ifdef QV_STORAGE_BLOCK_BYTES
+    constexpr size_t storageBlockBytes = QV_STORAGE_BLOCK_BYTES;
+#else
+    constexpr size_t storageBlockBytes = 16384;
+#endif
+
+    // Handles pack a slot index in the low bits with the slot's generation above it. Slots are recycled once their
+    // entity is destroyed, and the generation is bumped so stale handles to the slot can be told apart
+#ifdef QV_COMPACT_ENTITY_HANDLES
+    using EntityHandle = uint32_t;
+    constexpr size_t entityIndexBits = 24;
+#else
+    using EntityHandle = uint64_t;
+    constexpr size_t entityIndexBits = 32;
+#endif
+
+    constexpr EntityHandle entityIndexMask = (EntityHandle{1} << entityIndexBits) - 1;
+    constexpr EntityHandle entityGenerationMask = std::numeric_limits<EntityHandle>::max() >> entityIndexBits;
+
+    constexpr size_t entityIndex(EntityHandle handle) {
+        return handle & entityIndexMask;
+    }
+
+    constexpr size_t entityGeneration(EntityHandle handle) {
+        return handle >> entityIndexBits;
+    }
+
+    constexpr EntityHandle makeEntityHandle(size_t index, size_t generation) {
+        return static_cast<EntityHandle>(((generation & entityGenerationMask) << entityIndexBits) | index);
+    }
+
+    // Maps entity handles to indices in a dense array, with the sparse side indexed by entity index and split into
+    // fixed-size pages so only the index ranges actually in use are allocated
+    class SparseSet {
+    public:
+        static constexpr size_t npos = std::numeric_limits<size_t>::max();
+        static constexpr size_t pageSize = 4096;
+
+        // Also compares generations, so a stale handle to a recycled slot isn't contained
+        [[nodiscard]] bool contains(EntityHandle handle) const {
+            auto page = entityIndex(handle) / pageSize;
+            if (page >= sparse.size() || !sparse[page]) return false;
+
+            auto slot = (*sparse[page])[entityIndex(handle) % pageSize];
+            return slot != npos && dense[slot] == handle;
+        }
+
+        // Does no bounds checking, handle must be contained in the set
+        [[nodiscard]] size_t index(EntityHandle handle) const {
+            return (*sparse[entityIndex(handle) / pageSize])[entityIndex(handle) % pageSize];
+        }
+
+        size_t insert(EntityHandle handle) {
+            auto& slot = assurePage(entityIndex(handle) / pageSize)[entityIndex(handle) % pageSize];
+            slot = dense.size();
+            dense.push_back(handle);
+            return slot;
+        }
+
+        // Swap-removes handle from the dense array, returns the handle moved into its place
+        EntityHandle erase(EntityHandle handle) {
+            auto& slot = (*sparse[entityIndex(handle) / pageSize])[entityIndex(handle) % pageSize];
+            auto otherHandle = dense.back();
+            (*sparse[entityIndex(otherHandle) / pageSize])[entityIndex(otherHandle) % pageSize] = slot;
+            dense[slot] = otherHandle;
+
+            dense.pop_back();
+            slot = npos;
+            return otherHandle;
+        }
+
+        // Exchanges the dense positions of two contained handles
+        void swap(EntityHandle first, EntityHandle second) {
+            auto& firstSlot = (*sparse[entityIndex(first) / pageSize])[entityIndex(first) % pageSize];
+            auto& secondSlot = (*sparse[entityIndex(second) / pageSize])[entityIndex(second) % pageSize];
+            std::swap(dense[firstSlot], dense[secondSlot]);
+            std::swap(firstSlot, secondSlot);
+        }
+
+        [[nodiscard]] const std::vector<EntityHandle>& handles() const {
+            return dense;
+        }
+
+        [[nodiscard]] size_t size() const {
+            return dense.size();
+        }
+
+        // Reorders the dense array to follow other's, which must contain every handle here. Walks all of other, so
+        // it's only cheaper than sort() while this set holds a good part of it
+        void sortAs(const SparseSet& other) {
+            std::vector<EntityHandle> sorted;
+            sorted.reserve(dense.size());
+            for (auto handle : other.dense) {
+                if (contains(handle)) {
+                    sorted.push_back(handle);
+                }
+            }
+
+            dense = std::move(sorted);
+            for (size_t slot = 0; slot < dense.size(); slot++) {
+                (*sparse[entityIndex(dense[slot]) / pageSize])[entityIndex(dense[slot]) % pageSize] = slot;
+            }
+        }
+
+        // Reorders the dense array by ascending key(handle), computing each key once rather than per comparison
+        template<typename Key>
+        void sort(Key&& key) {
+            std::vector<std::pair<std::invoke_result_t<Key&, EntityHandle>, EntityHandle>> keyed;
+            keyed.reserve(dense.size());
+            for (auto handle : dense) {
+                keyed.emplace_back(key(handle), handle);
+            }
+
+            std::ranges::sort(keyed);
+            for (size_t slot = 0; slot < dense.size(); slot++) {
+                dense[slot] = keyed[slot].second;
+                (*sparse[entityIndex(dense[slot]) / pageSize])[entityIndex(dense[slot]) % pageSize] = slot;
+            }
+        }
+    private:
+        using Page = std::array<size_t, pageSize>;
+
+        Page& assurePage(size_t page) {
+            if (page >= sparse.size()) {
+                sparse.resize(page + 1);
+            }
+
+            if (!sparse[page]) {
+                sparse[page] = std::make_unique<Page>();
+                sparse[page]->fill(npos);
+            }
+
+            return *sparse[page];
+        }
+
+        std::vector<std::unique_ptr<Page>> sparse;
+        std::vector<EntityHandle> dense;
+    };
+
+    // Vector-like storage split into fixed-size blocks that are never reallocated, so growing it doesn't move any
+    // element. An element only changes address when it is erased, or when it is the last element and is moved
+    // into an erased slot
+    template<typename T>
+    class BlockStorage {
+    public:
+        using reference = T&;
+
+        static constexpr size_t blockSize = std::max<size_t>(1, std::bit_floor(storageBlockBytes / sizeof(T)));
+
+        BlockStorage()=default;
+        BlockStorage(const BlockStorage&)=delete;
+        BlockStorage& operator=(const BlockStorage&)=delete;
+
+        ~BlockStorage() {
+            while (count > 0) {
+                pop_back();
+            }
+
+            for (auto block : blocks) {
+                std::allocator<T>{}.deallocate(block, blockSize);
+            }
+        }
+
+        template<typename... Args>
+        T& emplace_back(Args&&... args) {
+            if (count == blocks.size() * blockSize) {
+                blocks.push_back(std::allocator<T>{}.allocate(blockSize));
+            }
+
+            auto element = std::construct_at(&(*this)[count], std::forward<Args>(args)...);
+            count++;
+            return *element;
+        }
+
+        void pop_back() {
+            count--;
+            std::destroy_at(&(*this)[count]);
+        }
+
+        // Moves the last element into index, then pops the back
+        void erase(size_t index) {
+            if (index != count - 1) {
+                (*this)[index] = std::move(back());
+            }
+
+            pop_back();
+        }
+
+        void swap(size_t first, size_t second) {
+            std::ranges::swap((*this)[first], (*this)[second]);
+        }
+
+        T& operator[](size_t index) {
+            return blocks[index / blockSize][index % blockSize];
+        }
+
+        T& back() {
+            return (*this)[count - 1];
+        }
+
+        [[nodiscard]] size_t size() const {
+            return count;
+        }
+
+        // One past the last index stored contiguously with index
+        [[nodiscard]] size_t blockEnd(size_t index) const {
+            return (index / blockSize + 1) * blockSize;
+        }
+
+        // The range must not cross a block boundary
+        std::span<T> span(size_t index, size_t length) {
+            return std::span<T>{&(*this)[index], length};
+        }
+    private:
+        std::vector<T*> blocks;
+        size_t count = 0;
+    };
+
+    // Lists the members of an aggregate component to store as separate columns, e.g.
+    // SoA<&Transform::x, &Transform::y, &Transform::z>. Every member must be listed, as only listed ones are stored
+    template<auto... Members>
+    struct SoA {};
+
+    // Converts to any type, so counting the initializers an aggregate accepts counts its members
+    struct AnyMember {
+        template<typename T>
+        operator T() const;
+    };
+
+    // C array members count once per element, as their braces can be elided
+    template<typename Aggregate, typename... Initializers>
+    constexpr size_t aggregateMemberCount() {
+        if constexpr (requires { Aggregate{Initializers{}..., AnyMember{}}; }) {
+            return aggregateMemberCount<Aggregate, Initializers..., AnyMember>();
+        } else {
+            return sizeof...(Initializers);
+        }
+    }
+
+    // Specialize with `using type = SoA<...>;` to opt a component into structure-of-arrays storage
+    template<typename Component>
+    struct ComponentLayout {
+        using type = void;
+    };
+
+    template<typename>
+    struct MemberTraits;
+
+    template<typename Class, typename Member>
+    struct MemberTraits<Member Class::*> {
+        using type = Member;
+    };
+
+    template<auto Member>
+    using MemberType = typename MemberTraits<decltype(Member)>::type;
+
+    // A member as seen through a proxy, const when the component was declared const
+    template<typename Component, auto Member>
+    using FieldType = std::conditional_t<std::is_const_v<Component>, const MemberType<Member>, MemberType<Member>>;
+
+    template<auto Member, auto... Members>
+    constexpr size_t memberIndex() {
+        constexpr std::array matches{std::is_same_v<SoA<Member>, SoA<Members>>...};
+        return std::ranges::find(matches, true) - matches.begin();
+    }
+
+    // Proxy for one component in structure-of-arrays storage. Each field is reached with field<&Component::member>(),
+    // structured bindings in SoA declaration order, or the whole component is copied in and out by conversion. A proxy
+    // for a const Component only reads, and one for the mutable component converts to it
+    template<typename Component, auto... Members>
+    class SoAReference {
+    public:
+        explicit SoAReference(FieldType<Component, Members>&... fields) : fields{fields...} {}
+
+        template<typename Mutable = std::remove_const_t<Component>> requires std::is_const_v<Component>
+        SoAReference(const SoAReference<Mutable, Members...>& other) : fields{other.fields} {}
+
+        template<auto Member>
+        FieldType<Component, Member>& field() const {
+            static_assert(memberIndex<Member, Members...>() < sizeof...(Members), "Member isn't part of the SoA layout");
+            return std::get<memberIndex<Member, Members...>()>(fields);
+        }
+
+        template<size_t Index>
+        auto& get() const {
+            return std::get<Index>(fields);
+        }
+
+        operator std::remove_const_t<Component>() const {
+            std::remove_const_t<Component> component{};
+            ((component.*Members = field<Members>()), ...);
+            return component;
+        }
+
+        const SoAReference& operator=(const Component& component) const requires (!std::is_const_v<Component>) {
+            ((field<Members>() = component.*Members), ...);
+            return *this;
+        }
+    private:
+        std::tuple<FieldType<Component, Members>&...> fields;
+
+        template<typename, auto...>
+        friend class SoAReference;
+    };
+
+    // Contiguous run of structure-of-arrays components, as one span per member
+    template<typename Component, auto... Members>
+    class SoASpan {
+    public:
+        SoASpan()=default;
+        explicit SoASpan(std::span<FieldType<Component, Members>>... fields) : fields{fields...} {}
+
+        template<typename Mutable = std::remove_const_t<Component>> requires std::is_const_v<Component>
+        SoASpan(const SoASpan<Mutable, Members...>& other) : fields{other.fields} {}
+
+        template<auto Member>
+        std::span<FieldType<Component, Member>> field() const {
+            static_assert(memberIndex<Member, Members...>() < sizeof...(Members), "Member isn't part of the SoA layout");
+            return std::get<memberIndex<Member, Members...>()>(fields);
+        }
+
+        [[nodiscard]] size_t size() const {
+            return std::get<0>(fields).size();
+        }
+
+        SoAReference<Component, Members...> operator[](size_t index) const {
+            return SoAReference<Component, Members...>{field<Members>()[index]...};
+        }
+    private:
+        std::tuple<std::span<FieldType<Component, Members>>...> fields;
+
+        template<typename, auto...>
+        friend class SoASpan;
+    };
+
+    // Keeps each listed member of a component in its own BlockStorage column, all indexed in parallel
+    template<typename Component, auto... Members>
+    class SoAStorage {
+    public:
+        using reference = SoAReference<Component, Members...>;
+
+        reference emplace_back(Component component) {
+            (column<Members>().emplace_back(std::move(component.*Members)), ...);
+            return back();
+        }
+
+        void pop_back() {
+            (column<Members>().pop_back(), ...);
+        }
+
+        void erase(size_t index) {
+            (column<Members>().erase(index), ...);
+        }
+
+        void swap(size_t first, size_t second) {
+            (column<Members>().swap(first, second), ...);
+        }
+
+        reference operator[](size_t index) {
+            return reference{column<Members>()[index]...};
+        }
+
+        reference back() {
+            return (*this)[size() - 1];
+        }
+
+        [[nodiscard]] size_t size() const {
+            return std::get<0>(columns).size();
+        }
+
+        // Columns have different block sizes, so the run ends at the first block boundary of any of them
+        [[nodiscard]] size_t blockEnd(size_t index) const {
+            return std::apply([index](const auto&... column) { return std::min({column.blockEnd(index)...}); }, columns);
+        }
+
+        SoASpan<Component, Members...> span(size_t index, size_t length) {
+            return SoASpan<Component, Members...>{column<Members>().span(index, length)...};
+        }
+
+        template<auto Member>
+        BlockStorage<MemberType<Member>>& column() {
+            return std::get<memberIndex<Member, Members...>()>(columns);
+        }
+    private:
+        std::tuple<BlockStorage<MemberType<Members>>...> columns;
+    };
+
+    template<typename Component, typename Layout = typename ComponentLayout<Component>::type>
+    struct StorageTraits {
+        using type = BlockStorage<Component>;
+    };
+
+    template<typename Component, auto... Members>
+    struct StorageTraits<Component, SoA<Members...>> {
+        static_assert(std::is_aggregate_v<Component> && aggregateMemberCount<Component>() == sizeof...(Members),
+                      "SoA layouts must list every member of the component");
+        using type = SoAStorage<Component, Members...>;
+    };
+
+    // Components a system declares const share the storage of the component itself
+    template<typename Component, typename Layout>
+    struct StorageTraits<const Component, Layout> : StorageTraits<Component> {};
+
+    // Turns a storage's proxy type into the proxy for Component, which is read-only when Component is const
+    template<typename Component, typename Proxy>
+    struct ProxyFor {
+        using type = Proxy;
+    };
+
+    template<typename Component, auto... Members>
+    struct ProxyFor<const Component, SoAReference<Component, Members...>> {
+        using type = SoAReference<const Component, Members...>;
+    };
+
+    template<typename Component, auto... Members>
+    struct ProxyFor<const Component, SoASpan<Component, Members...>> {
+        using type = SoASpan<const Component, Members...>;
+    };
+
+    template<typename Component>
+    using ComponentStorage = typename StorageTraits<Component>::type;
+
+#ifndef QV_ARCHETYPE_STORAGE
+    // Component& for ordinary components, a SoAReference proxy for structure-of-arrays ones. Const components give
+    // const references and read-only proxies
+    template<typename Component, typename Reference = typename ComponentStorage<Component>::reference>
+    using ComponentReference = std::conditional_t<std::is_reference_v<Reference>, Component&, typename ProxyFor<Component, Reference>::type>;
+
+    // std::span<Component> for ordinary components, a SoASpan for structure-of-arrays ones
+    template<typename Component, typename Span = decltype(std::declval<ComponentStorage<Component>&>().span(0, 0))>
+    using ComponentSpan = std::conditional_t<
+        std::is_reference_v<ComponentReference<Component>>, std::span<Component>, typename ProxyFor<Component, Span>::type
+    >;
+#else
+    // Archetype chunks always store components whole
+    template<typename Component>
+    using ComponentReference = Component&;
+
+    template<typename Component>
+    using ComponentSpan = std::span<Component>;
+#endif
+
+    // Component* for ordinary components, an optional SoAReference proxy for structure-of-arrays ones
+    template<typename Component, typename Reference = ComponentReference<Component>>
+    using OptionalReference = std::conditional_t<
+        std::is_reference_v<Reference>, std::remove_reference_t<Reference>*, std::optional<Reference>
+    >;
+
+    template<typename... Components>
+    struct ComponentList {
+        static constexpr size_t size = sizeof...(Components);
+
+        // Position of Component in the list, or size if it isn't listed
+        template<typename Component>
+        static constexpr size_t indexOf() {
+            constexpr std::array<bool, sizeof...(Components) + 1> matches{std::is_same_v<Component, Components>..., true};
+            return std::ranges::find(matches, true) - matches.begin();
+        }
+    };
+
+    // Excludes entities with any of Components from a system, e.g. System<Transform, Velocity, Without<Sleeping>>
+    template<typename... Components>
+    struct Without {};
+
+    // Gives a system access to Component on the entities that have it, without requiring it,
+    // e.g. System<Transform, Optional<Velocity>>
+    template<typename Component>
+    struct Optional {};
+
+    template<typename... Lists>
+    struct ConcatComponentLists {
+        using type = ComponentList<>;
+    };
+
+    template<typename... Components>
+    struct ConcatComponentLists<ComponentList<Components...>> {
+        using type = ComponentList<Components...>;
+    };
+
+    template<typename... First, typename... Second, typename... Lists>
+    struct ConcatComponentLists<ComponentList<First...>, ComponentList<Second...>, Lists...>
+        : ConcatComponentLists<ComponentList<First..., Second...>, Lists...> {};
+
+    // Sorts one System parameter into the components an entity must have, the ones it must not, and the ones it may
+    template<typename Term>
+    struct QueryTerm {
+        using required = ComponentList<Term>;
+        using excluded = ComponentList<>;
+        using optional = ComponentList<>;
+    };
+
+    template<typename... Components>
+    struct QueryTerm<Without<Components...>> {
+        using required = ComponentList<>;
+        using excluded = ComponentList<Components...>;
+        using optional = ComponentList<>;
+    };
+
+    template<typename Component>
+    struct QueryTerm<Optional<Component>> {
+        using required = ComponentList<>;
+        using excluded = ComponentList<>;
+        using optional = ComponentList<Component>;
+    };
+
+    template<typename... Terms>
+    using RequiredComponents = typename ConcatComponentLists<typename QueryTerm<Terms>::required...>::type;
+
+    template<typename... Terms>
+    using ExcludedComponents = typename ConcatComponentLists<typename QueryTerm<Terms>::excluded...>::type;
+
+    template<typename... Terms>
+    using OptionalComponents = typename ConcatComponentLists<typename QueryTerm<Terms>::optional...>::type;
+
+    // Opt-in compile-time component IDs. Specializing this before any component is used, e.g.
+    // template<> struct qv::StaticComponents<> { using type = qv::ComponentList<Transform, Velocity>; };
+    // gives each listed component its position in the list as a constexpr ID. Components registered without being
+    // listed still get runtime IDs, numbered after the static ones
+    template<typename = void>
+    struct StaticComponents {
+        using type = ComponentList<>;
+    };
+
+    // Looked up through the component type so the user's specialization is only needed once components are used
+    template<typename Component>
+    using StaticComponentList = typename StaticComponents<std::void_t<Component>>::type;
+
+    template<typename Component>
+    constexpr bool isStaticComponent = StaticComponentList<Component>::template indexOf<Component>() < StaticComponentList<Component>::size;
+
+    template<typename Component, bool Static = isStaticComponent<Component>>
+    struct ComponentIdentity {
+        static inline ComponentSignature signature;
+        static inline size_t signatureBit;
+    };
+
+    template<typename Component>
+    struct ComponentIdentity<Component, true> {
+        static constexpr size_t signatureBit = StaticComponentList<Component>::template indexOf<Component>();
+        static_assert(signatureBit < componentBitsetSize, "Static component IDs must fit in the inline signature bits");
+#ifndef _GLIBCXX_DEBUG
+        static constexpr ComponentSignature signature = ComponentSignature{}.set(signatureBit);
+#else
+        // Debug mode vectors aren't literal types, so the signature can't be a constant there
+        static inline const ComponentSignature signature = ComponentSignature{}.set(signatureBit);
+#endif
+    };
+
+    template<typename Component>
+    struct Registrar : ComponentIdentity<Component> {
+        using ComponentIdentity<Component>::signature;
+        using ComponentIdentity<Component>::signatureBit;
+        static inline ComponentStorage<Component> components;
+        static inline SparseSet entities; // Dense side is parallel to components
+
+        static void addComponent(Component component, EntityHandle handle) {
+            components.template emplace_back(std::move(component));
+            entities.insert(handle);
+        }
+
+        static void createComponent(EntityHandle handle) {
+            addComponent(Component{}, handle);
+        }
+
+        // Returns the handle whose component was moved into the removed slot
+        static EntityHandle removeComponent(EntityHandle handle) {
+            components.erase(entities.index(handle));
+            return entities.erase(handle);
+        }
+
+        // Exchanges the slots of two entities' components
+        static void swapComponents(EntityHandle first, EntityHandle second) {
+            components.swap(entities.index(first), entities.index(second));
+            entities.swap(first, second);
+        }
+
+        static ComponentReference<Component> getComponent(EntityHandle handle) {
+            return components[entities.index(handle)];
+        }
+
+        static bool contains(EntityHandle handle) {
+            return entities.contains(handle);
+        }
+
+        // Empty when the entity doesn't have the component
+        static OptionalReference<Component> findComponent(EntityHandle handle) {
+            if (!contains(handle)) return {};
+
+            if constexpr (std::is_pointer_v<OptionalReference<Component>>) {
+                return &getComponent(handle);
+            } else {
+                return getComponent(handle);
+            }
+        }
+    };
+
+    // Systems reading a component through const share its registrar
+    template<typename Component>
+    struct Registrar<const Component> : Registrar<Component> {};
+
+    // Runs parallel loops on a fixed set of worker threads plus the calling thread. Each thread starts with an equal
+    // share of the range and takes grain-sized pieces off its front, and a thread that runs out steals the back half of
+    // another's remaining range, so the pieces adapt to uneven work. Dispatching doesn't allocate
+    class ThreadPool {
+    public:
+        // A threadCount of 0 is treated as 1, the calling thread alone
+        explicit ThreadPool(size_t threadCount = std::thread::hardware_concurrency()) : ranges(std::max<size_t>(1, threadCount)) {
+            for (size_t index = 1; index < size(); index++) {
+                workers.emplace_back([this, index] { work(index); });
+            }
+        }
+
+        ThreadPool(const ThreadPool&)=delete;
+        ThreadPool& operator=(const ThreadPool&)=delete;
+
+        ~ThreadPool() {
+            stopping = true;
+            generation.fetch_add(1, std::memory_order_release);
+            generation.notify_all();
+            for (auto& worker : workers) {
+                worker.join();
+            }
+        }
+
+        // Used by System::parallelForEach, sized to the hardware and started on first use
+        static ThreadPool& getDefault() {
+            static ThreadPool pool;
+            return pool;
+        }
+
+        // Threads taking part in a loop, including the caller
+        [[nodiscard]] size_t size() const {
+            return ranges.size();
+        }
+
+        // The pool whose loop or worker the calling thread is running, or null outside any pool
+        static ThreadPool* getCurrentPool() {
+            return currentPool;
+        }
+
+        // Index of the calling thread in getCurrentPool(), the thread that dispatched the loop being 0
+        static size_t getThreadIndex() {
+            return threadIndex;
+        }
+
+        // Calls function(begin, end) on disjoint ranges covering [0, count), each at most grainSize long, and returns
+        // once all are done. A grainSize of 0 picks one from count. Loops started from inside a loop, or while another
+        // thread's loop is running, run serially on the calling thread instead
+        template<typename Function>
+        void parallelFor(size_t count, size_t grainSize, Function&& function) {
+            assert(count <= std::numeric_limits<uint32_t>::max() && "Parallel loops are limited to 32 bit ranges");
+            if (grainSize == 0) {
+                grainSize = std::max<size_t>(1, count / (size() * 16));
+            }
+
+            if (count <= grainSize || size() == 1 || insideLoop || !dispatchMutex.try_lock()) {
+                for (size_t begin = 0; begin < count; begin += grainSize) {
+                    function(begin, std::min(count, begin + grainSize));
+                }
+                return;
+            }
+
+            std::lock_guard lock{dispatchMutex, std::adopt_lock};
+            job = Job{&function, [](void* function, size_t begin, size_t end) {
+                (*static_cast<std::remove_reference_t<Function>*>(function))(begin, end);
+            }, grainSize};
+
+            for (size_t index = 0; index < size(); index++) {
+                ranges[index].bounds.store(packRange(count * index / size(), count * (index + 1) / size()), std::memory_order_relaxed);
+            }
+
+            busyWorkers.store(workers.size(), std::memory_order_relaxed);
+            generation.fetch_add(1, std::memory_order_release);
+            generation.notify_all();
+
+            auto outerPool = std::exchange(currentPool, this);
+            auto outerIndex = std::exchange(threadIndex, 0);
+            insideLoop = true;
+            run(0);
+            insideLoop = false;
+            currentPool = outerPool;
+            threadIndex = outerIndex;
+
+            for (auto busy = busyWorkers.load(std::memory_order_acquire); busy != 0; busy = busyWorkers.load(std::memory_order_acquire)) {
+                busyWorkers.wait(busy, std::memory_order_acquire);
+            }
+        }
+    private:
+        struct Job {
+            void* function;
+            void (*invoke)(void* function, size_t begin, size_t end);
+            size_t grainSize;
+        };
+
+        // A thread's remaining [begin, end), packed so it can be claimed with a single compare-exchange
+        struct alignas(64) Range {
+            std::atomic<uint64_t> bounds;
+        };
+
+        static uint64_t packRange(size_t begin, size_t end) {
+            return static_cast<uint64_t>(begin) << 32 | end;
+        }
+
+        void work(size_t index) {
+            insideLoop = true;
+            currentPool = this;
+            threadIndex = index;
+            uint64_t seen = 0;
+            while (true) {
+                generation.wait(seen, std::memory_order_acquire);
+                seen = generation.load(std::memory_order_acquire);
+                if (stopping) return;
+
+                run(index);
+                if (busyWorkers.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    busyWorkers.notify_all();
+                }
+            }
+        }
+
+        void run(size_t index) {
+            do {
+                auto bounds = ranges[index].bounds.load(std::memory_order_relaxed);
+                while (true) {
+                    size_t begin = bounds >> 32, end = bounds & 0xffffffff;
+                    if (begin >= end) break;
+
+                    auto split = std::min(end, begin + job.grainSize);
+                    if (ranges[index].bounds.compare_exchange_weak(bounds, packRange(split, end), std::memory_order_relaxed)) {
+                        job.invoke(job.function, begin, split);
+                        bounds = ranges[index].bounds.load(std::memory_order_relaxed);
+                    }
+                }
+            } while (steal(index));
+        }
+
+        // Moves the back half of the first non-empty range found into this thread's range
+        bool steal(size_t index) {
+            for (size_t offset = 1; offset < size(); offset++) {
+                auto& victim = ranges[(index + offset) % size()].bounds;
+                auto bounds = victim.load(std::memory_order_relaxed);
+                while (true) {
+                    size_t begin = bounds >> 32, end = bounds & 0xffffffff;
+                    if (begin >= end) break;
+
+                    auto split = end - begin > job.grainSize ? begin + (end - begin) / 2 : begin;
+                    if (victim.compare_exchange_weak(bounds, packRange(begin, split), std::memory_order_relaxed)) {
+                        ranges[index].bounds.store(packRange(split, end), std::memory_order_relaxed);
+                        return true;
+                    }
+                }
+            }
+            return false;
+        }
+
+        std::vector<Range> ranges; // One per thread, the caller's first
+        std::vector<std::thread> workers;
+        Job job{};
+        std::mutex dispatchMutex;
+        std::atomic<uint64_t> generation = 0; // Bumped to wake the workers for each loop
+        std::atomic<size_t> busyWorkers = 0;
+        std::atomic<bool> stopping = false;
+        static inline thread_local bool insideLoop = false;
+        static inline thread_local ThreadPool* currentPool = nullptr;
+        static inline thread_local size_t threadIndex = 0;
+    };
+
+    // How a query is executed, returned by World::planQuery() to check which pool drives it
+    struct QueryPlan {
+        std::vector<size_t> components; // Component IDs, the driving one first and the rest in probe order
+        std::vector<size_t> cardinalities; // Size of each component's pool when the plan was made, in the same order
+        std::vector<size_t> archetypeSizes; // Entities in each matched archetype, only filled in archetype storage
+    };
+
+    class CommandBuffer;
+    class ParallelCommandBuffer;
+
+    class World {
+    public:
+        template<typename Component, typename... Components>
+        static void registerComponent() {
+            if constexpr (!isStaticComponent<Component>) {
+                // Runtime IDs are numbered after the static ones
+                componentId = std::max(componentId, StaticComponentList<Component>::size);
+                Registrar<Component>::signature = ComponentSignature{}.set(componentId);
+                Registrar<Component>::signatureBit = componentId;
+                componentId++;
+            }
+
+            auto bit = Registrar<Component>::signatureBit;
+            #ifndef QV_ARCHETYPE_STORAGE
+                if (destructors.size() <= bit) {
+                    destructors.resize(bit + 1);
+                    systemDescriptors.resize(bit + 1);
+                    excludingDescriptors.resize(bit + 1);
+                    optionalDescriptors.resize(bit + 1);
+                    componentOwners.resize(bit + 1);
+                    ownedDescriptors.resize(bit + 1);
+                }
+                destructors[bit] = &World::destroyComponent<Component>;
+            #else
+                if (componentInfos.size() <= bit) {
+                    componentInfos.resize(bit + 1);
+                }
+                componentInfos[bit] = ComponentInfo::of<Component>();
+            #endif
+
+            if constexpr (sizeof...(Components) != 0) {
+                registerComponent<Components...>();
+            }
+        }
+
+        // Applies the buffer's commands and empties it, see CommandBuffer
+        static void flush(CommandBuffer& buffer);
+
+        // Applies every thread's commands in system and chunk order and empties the buffers, see ParallelCommandBuffer
+        static void flush(ParallelCommandBuffer& buffer);
+
+        // Applies the commands recorded in getCommandBuffer()
+        static void flush();
+
+        // A buffer shared by the code that only runs on the main thread
+        static CommandBuffer& getCommandBuffer();
+
+        // Fills handles with reserved handles, taken with a single atomic operation. Reserved handles become entities
+        // without components at the next flush. Safe to call from any number of threads at once, as long as none are
+        // creating or destroying entities meanwhile
+        static void reserveEntities(std::span<EntityHandle> handles) {
+            auto count = static_cast<ptrdiff_t>(handles.size());
+            auto first = reserveCursor.fetch_sub(count, std::memory_order_relaxed) - count;
+            for (ptrdiff_t offset = 0; offset < count; offset++) {
+                handles[offset] = reservedHandle(first + offset);
+            }
+        }
+
+        static EntityHandle reserveEntity() {
+            EntityHandle handle;
+            reserveEntities({&handle, 1});
+            return handle;
+        }
+
+        // True while handle refers to a live entity, false once it is destroyed or its slot is recycled
+        static bool isAlive(EntityHandle handle) {
+            auto index = entityIndex(handle);
+            return index != 0 && index < entityHandles.size() && entityHandles[index] == handle;
+        }
+
+#ifndef QV_ARCHETYPE_STORAGE
+        static EntityHandle createEntity() {
+            auto handle = allocateHandle();
+            if (entityIndex(handle) >= entitySignatures.size()) {
+                entitySignatures.resize(entityIndex(handle) + 1);
+            }
+            return handle;
+        }
+
+        // System membership is derived from the signature rather than stored per entity: each matching system is
+        // found through the table of systems owned by its lowest component bit, so it is visited exactly once.
+        // Stale handles are ignored, so an entity destroyed through a CommandBuffer can still be destroyed by its owner
+        static void destroyEntity(EntityHandle handle) {
+            if (!isAlive(handle)) return;
+
+            ComponentSignature& signature = entitySignatures[entityIndex(handle)];
+            signature.forEachBit([&signature, handle](size_t bit) {
+                ownedDescriptors[bit].match(signature, [handle](SystemDescriptor* descriptor) {
+                    descriptor->eraseEntity(handle);
+                });
+            });
+
+            signature.forEachBit([handle](size_t bit) {
+                destructors[bit](handle);
+            });
+
+            signature.reset();
+            releaseHandle(handle);
+        }
+
+        // Gaining a component can also take the entity out of systems excluding it
+        template<typename Component>
+        static void addComponent(EntityHandle handle, Component component = {}) {
+            auto& signature = entitySignatures[entityIndex(handle)];
+            excludingDescriptors[Registrar<Component>::signatureBit].match(signature, [handle](SystemDescriptor* descriptor) {
+                descriptor->eraseEntity(handle);
+            });
+
+            signature.set(Registrar<Component>::signatureBit);
+            Registrar<Component>::addComponent(std::move(component), handle);
+
+            systemDescriptors[Registrar<Component>::signatureBit].match(signature, [handle](SystemDescriptor* descriptor) {
+                descriptor->insertEntity(handle);
+            });
+            refreshOptional(Registrar<Component>::signatureBit, handle);
+        }
+
+        template<typename Component>
+        static void removeComponent(EntityHandle handle) {
+            auto& signature = entitySignatures[entityIndex(handle)];
+            systemDescriptors[Registrar<Component>::signatureBit].match(signature, [handle](SystemDescriptor* descriptor) {
+                descriptor->eraseEntity(handle);
+            });
+
+            signature.reset(Registrar<Component>::signatureBit);
+            destroyComponent<Component>(handle);
+            refreshOptional(Registrar<Component>::signatureBit, handle);
+
+            excludingDescriptors[Registrar<Component>::signatureBit].match(signature, [handle](SystemDescriptor* descriptor) {
+                descriptor->insertEntity(handle);
+            });
+        }
+
+        template<typename Component>
+        static ComponentReference<Component> getComponent(EntityHandle handle) {
+            return Registrar<Component>::getComponent(handle);
+        }
+
+        template<typename Component>
+        static bool hasComponent(EntityHandle handle) {
+            return Registrar<Component>::contains(handle);
+        }
+
+        // Iterates every entity with all of Components as the same tuples System::getComponents() holds, without
+        // registering a system. Nothing is cached, so an unused view costs nothing: it is executed as planQuery()
+        // describes. Adding or removing components invalidates the view
+        template<typename... Components>
+        static auto view() {
+            auto pools = planPools<Components...>();
+            auto driver = pools.front().second;
+            auto probes = std::array<const SparseSet*, sizeof...(Components) - 1>{};
+            std::ranges::copy(pools | std::views::drop(1) | std::views::values, probes.begin());
+
+            return driver->handles()
+                | std::views::filter([probes](EntityHandle handle) {
+                    return std::ranges::all_of(probes, [handle](const SparseSet* pool) { return pool->contains(handle); });
+                })
+                | std::views::transform([](EntityHandle handle) {
+                    return std::tuple<ComponentReference<Components>..., EntityHandle>{Registrar<Components>::getComponent(handle)..., handle};
+                });
+        }
+
+        // The plan view<Components...>() would currently use. Component pools are ordered by size, the smallest one
+        // drives iteration and the rest are probed in order, so entities are rejected by the most selective pool first
+        template<typename... Components>
+        static QueryPlan planQuery() {
+            QueryPlan plan;
+            for (auto [bit, pool] : planPools<Components...>()) {
+                plan.components.push_back(bit);
+                plan.cardinalities.push_back(pool->size());
+            }
+            return plan;
+        }
+#else
+        static EntityHandle createEntity() {
+            auto handle = allocateHandle();
+            if (entityIndex(handle) >= entityLocations.size()) {
+                entityLocations.resize(entityIndex(handle) + 1);
+            }
+
+            return handle;
+        }
+
+        // Stale handles are ignored, as in registrar mode
+        static void destroyEntity(EntityHandle handle) {
+            if (!isAlive(handle)) return;
+
+            moveEntity(handle, nullptr);
+            releaseHandle(handle);
+        }
+
+        template<typename Component>
+        static void addComponent(EntityHandle handle, Component component = {}) {
+            moveEntity(handle, getArchetype(getSignature(handle) | Registrar<Component>::signature));
+            getComponent<Component>(handle) = std::move(component);
+        }
+
+        template<typename Component>
+        static void removeComponent(EntityHandle handle) {
+            moveEntity(handle, getArchetype(getSignature(handle).reset(Registrar<Component>::signatureBit)));
+        }
+
+        template<typename Component>
+        static Component& getComponent(EntityHandle handle) {
+            auto& location = entityLocations[entityIndex(handle)];
+            return location.archetype->template getComponent<Component>(location.row);
+        }
+
+        template<typename Component>
+        static bool hasComponent(EntityHandle handle) {
+            auto archetype = entityLocations[entityIndex(handle)].archetype;
+            return archetype && archetype->signature.test(Registrar<Component>::signatureBit);
+        }
+
+        // Iterates every entity with all of Components as the same tuples System::getComponents() holds, without
+        // registering a system. Nothing is cached, so an unused view costs nothing: archetypes are matched against the
+        // signature on each call. Adding or removing components invalidates the view
+        template<typename... Components>
+        static auto view() {
+            static_assert(sizeof...(Components) > 0, "Views need at least one component");
+            return archetypes
+                | std::views::filter([signature = generateSignature<Components...>()](const Archetype& archetype) {
+                    return archetype.signature.contains(signature);
+                })
+                | std::views::transform([](Archetype& archetype) {
+                    return std::views::iota(size_t{0}, archetype.count) | std::views::transform([&archetype](size_t row) {
+                        return std::tuple<Components&..., EntityHandle>{
+                            archetype.template getComponent<Components>(row)..., archetype.handle(row)
+                        };
+                    });
+                })
+                | std::views::join;
+        }
+
+        // Archetype views visit every matching archetype rather than driving from one pool, but components are still
+        // ordered by how many entities have them, as in the default storage, so both report the same statistics
+        template<typename... Components>
+        static QueryPlan planQuery() {
+            static_assert(sizeof...(Components) > 0, "Queries need at least one component");
+            auto pools = std::array{std::pair<size_t, size_t>{Registrar<Components>::signatureBit, 0}...};
+            auto signature = generateSignature<Components...>();
+
+            QueryPlan plan;
+            for (auto& archetype : archetypes) {
+                for (auto& [bit, size] : pools) {
+                    size += archetype.signature.test(bit) ? archetype.count : 0;
+                }
+                if (archetype.signature.contains(signature)) {
+                    plan.archetypeSizes.push_back(archetype.count);
+                }
+            }
+
+            std::ranges::stable_sort(pools, {}, [](const auto& pool) { return pool.second; });
+            for (auto [bit, size] : pools) {
+                plan.components.push_back(bit);
+                plan.cardinalities.push_back(size);
+            }
+            return plan;
+        }
+#endif
+
+        // Constant-evaluable when every component has a static ID
+        template<typename... Components>
+        static constexpr ComponentSignature generateSignature() {
+            return (ComponentSignature{} | ... | Registrar<Components>::signature);
+        }
+
+    private:
+        struct Archetype;
+
+        // Hooks are the static functions of the System instantiation, so plain function pointers suffice
+        struct SystemDescriptor {
+            ComponentSignature signature;
+            ComponentSignature exclusion;
+            #ifndef QV_ARCHETYPE_STORAGE
+                void (*insertEntity)(EntityHandle);
+                void (*eraseEntity)(EntityHandle);
+                void (*refreshEntity)(EntityHandle);
+            #else
+                void (*insertArchetype)(Archetype*);
+            #endif
+            void (*invalidateComponentList)();
+        };
+
+#ifndef QV_ARCHETYPE_STORAGE
+        // Each component's ID and pool, smallest pool first. Registrars keep their pool sizes current, so they serve
+        // as the cardinalities without any extra bookkeeping
+        template<typename... Components>
+        static std::array<std::pair<size_t, const SparseSet*>, sizeof...(Components)> planPools() {
+            static_assert(sizeof...(Components) > 0, "Queries need at least one component");
+            auto pools = std::array{std::pair<size_t, const SparseSet*>{Registrar<Components>::signatureBit, &Registrar<Components>::entities}...};
+            std::ranges::stable_sort(pools, {}, [](const auto& pool) { return pool.second->size(); });
+            return pools;
+        }
+#endif
+
+        static bool compareSignatures(const ComponentSignature& entity, const SystemDescriptor& system) {
+            return entity.contains(system.signature) && !entity.intersects(system.exclusion);
+        }
+
+        // Reuses the most recently released slot, whose generation was already bumped on release
+        static EntityHandle allocateHandle() {
+            materializeReserved();
+            if (!freeIndices.empty()) {
+                auto index = freeIndices.back();
+                freeIndices.pop_back();
+                reserveCursor.store(static_cast<ptrdiff_t>(freeIndices.size()), std::memory_order_relaxed);
+                return entityHandles[index] = freeSlotHandle(index);
+            }
+
+            assert(entityHandles.size() <= entityIndexMask && "Out of entity indices");
+            return entityHandles.emplace_back(makeEntityHandle(entityHandles.size(), 0));
+        }
+
+        static void releaseHandle(EntityHandle handle) {
+            materializeReserved();
+            auto index = entityIndex(handle);
+            entityHandles[index] = makeEntityHandle(0, entityGeneration(handle) + 1);
+            freeIndices.push_back(index);
+            reserveCursor.store(static_cast<ptrdiff_t>(freeIndices.size()), std::memory_order_relaxed);
+        }
+
+        // Reservations count reserveCursor down from the end of freeIndices, taking the free slots in the order
+        // allocateHandle() would, then past the end of entityHandles as negative positions
+        static EntityHandle reservedHandle(ptrdiff_t position) {
+            if (position >= 0) {
+                return freeSlotHandle(freeIndices[position]);
+            }
+
+            auto index = entityHandles.size() + static_cast<size_t>(-position - 1);
+            assert(index <= entityIndexMask && "Out of entity indices");
+            return makeEntityHandle(index, 0);
+        }
+
+        // Turns every outstanding reservation into an entity, run by the flush and before handles are allocated or
+        // released so the free list never changes under a reservation. Cancelled reservations are destroyed after
+        static void materializeReserved() {
+            auto cursor = reserveCursor.load(std::memory_order_relaxed);
+            if (cursor != static_cast<ptrdiff_t>(freeIndices.size())) {
+                materializeSlots(cursor);
+            }
+
+            if (reservationsCancelled.load(std::memory_order_relaxed)) {
+                std::vector<EntityHandle> cancelled;
+                {
+                    std::lock_guard lock{cancelledMutex};
+                    std::swap(cancelled, cancelledReservations);
+                    reservationsCancelled.store(false, std::memory_order_relaxed);
+                }
+
+                for (auto handle : cancelled) {
+                    destroyEntity(handle);
+                }
+            }
+        }
+
+        // For reserved handles whose creation was dropped, from any thread
+        static void cancelReservation(EntityHandle handle) {
+            std::lock_guard lock{cancelledMutex};
+            cancelledReservations.push_back(handle);
+            reservationsCancelled.store(true, std::memory_order_relaxed);
+        }
+
+        static void materializeSlots(ptrdiff_t cursor) {
+            for (auto position = static_cast<size_t>(std::max<ptrdiff_t>(cursor, 0)); position < freeIndices.size(); position++) {
+                entityHandles[freeIndices[position]] = freeSlotHandle(freeIndices[position]);
+            }
+            freeIndices.resize(std::max<ptrdiff_t>(cursor, 0));
+            for (auto fresh = std::min<ptrdiff_t>(cursor, 0); fresh < 0; fresh++) {
+                entityHandles.push_back(makeEntityHandle(entityHandles.size(), 0));
+            }
+#ifndef QV_ARCHETYPE_STORAGE
+            entitySignatures.resize(std::max(entitySignatures.size(), entityHandles.size()));
+#else
+            entityLocations.resize(std::max(entityLocations.size(), entityHandles.size()));
+#endif
+            reserveCursor.store(static_cast<ptrdiff_t>(freeIndices.size()), std::memory_order_relaxed);
+        }
+
+        // Free slots hold their next generation with index 0, which no handle has, so isAlive() is false for every
+        // handle into them, including reserved ones until they are materialized
+        static EntityHandle freeSlotHandle(size_t index) {
+            return makeEntityHandle(index, entityGeneration(entityHandles[index]));
+        }
+
+        static inline size_t componentId = 0;
+
+        static inline std::vector<EntityHandle> entityHandles = std::vector<EntityHandle>(1); // Index 0 is the null handle, see freeSlotHandle()
+        static inline std::vector<size_t> freeIndices;
+        static inline std::atomic<ptrdiff_t> reserveCursor = 0; // freeIndices.size() while nothing is reserved
+        static inline std::vector<EntityHandle> cancelledReservations;
+        static inline std::mutex cancelledMutex;
+        static inline std::atomic<bool> reservationsCancelled = false;
+
+        static inline std::deque<SystemDescriptor> systems; // Deque keeps descriptor addresses stable
+
+#ifndef QV_ARCHETYPE_STORAGE
+        // Removes the component from its registrar, then rebinds the entity whose component filled the hole
+        template<typename Component>
+        static void destroyComponent(EntityHandle handle) {
+            auto movedHandle = Registrar<Component>::removeComponent(handle);
+            if (movedHandle == handle) return;
+
+            for (auto descriptor : systemDescriptors[Registrar<Component>::signatureBit].descriptors) {
+                descriptor->refreshEntity(movedHandle);
+            }
+            refreshOptional(Registrar<Component>::signatureBit, movedHandle);
+        }
+
+        // Moves the entity's component to index in its registrar, swapping it with the one there, for owning groups
+        template<typename Component>
+        static void moveComponent(EntityHandle handle, size_t index) {
+            auto otherHandle = Registrar<Component>::entities.handles()[index];
+            if (otherHandle == handle) return;
+
+            Registrar<Component>::swapComponents(handle, otherHandle);
+            for (auto descriptor : systemDescriptors[Registrar<Component>::signatureBit].descriptors) {
+                descriptor->refreshEntity(handle);
+                descriptor->refreshEntity(otherHandle);
+            }
+            refreshOptional(Registrar<Component>::signatureBit, handle);
+            refreshOptional(Registrar<Component>::signatureBit, otherHandle);
+        }
+
+        // Systems reading the component optionally hold a pointer to it even for entities without it
+        static void refreshOptional(size_t bit, EntityHandle handle) {
+            for (auto descriptor : optionalDescriptors[bit]) {
+                descriptor->refreshEntity(handle);
+            }
+        }
+
+        static inline std::vector<void (*)(EntityHandle)> destructors;
+        // Descriptors alongside a matrix of their signatures, so the systems an entity matches are found in bulk
+        struct DescriptorTable {
+            void push_back(SystemDescriptor* descriptor) {
+                descriptors.push_back(descriptor);
+                signatures.push_back(descriptor->signature, descriptor->exclusion);
+            }
+
+            // Calls function(descriptor) for each descriptor whose system signature matches
+            template<typename Function>
+            void match(const ComponentSignature& signature, Function&& function) const {
+                signatures.match(signature, [this, &function](size_t index) {
+                    function(descriptors[index]);
+                });
+            }
+
+            std::vector<SystemDescriptor*> descriptors;
+            SignatureMatrix signatures;
+        };
+
+        static inline std::vector<DescriptorTable> systemDescriptors; // Systems using each component bit
+        static inline std::vector<DescriptorTable> excludingDescriptors; // Systems excluding each component bit
+        static inline std::vector<std::vector<SystemDescriptor*>> optionalDescriptors; // Systems optionally reading each bit
+        static inline std::vector<SystemDescriptor*> componentOwners; // The owning group of each component bit, if any
+        static inline std::vector<DescriptorTable> ownedDescriptors; // Systems whose lowest component bit is each bit
+        static inline std::vector<ComponentSignature> entitySignatures; // Indexed by entity index
+#else
+        // Type-erased operations needed to move components between archetype chunks
+        struct ComponentInfo {
+            size_t size;
+            size_t alignment;
+            void (*construct)(void*);
+            void (*relocate)(void* destination, void* source); // Move-constructs destination, then destroys source
+            void (*destroy)(void*);
+
+            template<typename Component>
+            static ComponentInfo of() {
+                return ComponentInfo{
+                    sizeof(Component),
+                    alignof(Component),
+                    [](void* component) { std::construct_at(static_cast<Component*>(component)); },
+                    [](void* destination, void* source) {
+                        std::construct_at(static_cast<Component*>(destination), std::move(*static_cast<Component*>(source)));
+                        std::destroy_at(static_cast<Component*>(source));
+                    },
+                    [](void* component) { std::destroy_at(static_cast<Component*>(component)); }
+                };
+            }
+        };
+
+        // Stores every entity with one exact signature, packed into chunks of about storageBlockBytes. Each chunk
+        // holds a column of handles followed by one column per component, and only the last chunk is partially full
+        struct Archetype {
+            Archetype(ComponentSignature signature, const std::vector<ComponentInfo>& infos) : signature{signature} {
+                columnOf.resize(infos.size(), SparseSet::npos);
+                alignment = alignof(EntityHandle);
+                size_t entityBytes = sizeof(EntityHandle);
+                signature.forEachBit([&](size_t bit) {
+                    columnOf[bit] = columns.size();
+                    columns.push_back(infos.at(bit));
+                    alignment = std::max(alignment, infos.at(bit).alignment);
+                    entityBytes += infos.at(bit).size;
+                });
+
+                chunkCapacity = std::max<size_t>(1, storageBlockBytes / entityBytes);
+                while (chunkCapacity > 1 && layoutChunk(chunkCapacity) > storageBlockBytes) {
+                    chunkCapacity--;
+                }
+                chunkBytes = layoutChunk(chunkCapacity);
+            }
+
+            Archetype(const Archetype&)=delete;
+            Archetype& operator=(const Archetype&)=delete;
+
+            ~Archetype() {
+                for (size_t row = 0; row < count; row++) {
+                    for (size_t column = 0; column < columns.size(); column++) {
+                        columns[column].destroy(component(column, row));
+                    }
+                }
+
+                for (auto chunk : chunks) {
+                    ::operator delete(chunk, std::align_val_t{alignment});
+                }
+            }
+
+            [[nodiscard]] size_t chunkSize(size_t chunk) const {
+                return std::min(chunkCapacity, count - chunk * chunkCapacity);
+            }
+
+            EntityHandle* handles(size_t chunk) {
+                return reinterpret_cast<EntityHandle*>(chunks[chunk]);
+            }
+
+            EntityHandle handle(size_t row) {
+                return handles(row / chunkCapacity)[row % chunkCapacity];
+            }
+
+            template<typename Component>
+            Component* column(size_t chunk) {
+                return reinterpret_cast<Component*>(chunks[chunk] + columnOffsets[columnOf[Registrar<Component>::signatureBit]]);
+            }
+
+            // nullptr when the archetype doesn't store Component
+            template<typename Component>
+            Component* findColumn(size_t chunk) {
+                return signature.test(Registrar<Component>::signatureBit) ? column<Component>(chunk) : nullptr;
+            }
+
+            template<typename Component>
+            Component& getComponent(size_t row) {
+                return column<Component>(row / chunkCapacity)[row % chunkCapacity];
+            }
+
+            void* component(size_t column, size_t row) {
+                auto chunk = chunks[row / chunkCapacity];
+                return chunk + columnOffsets[column] + (row % chunkCapacity) * columns[column].size;
+            }
 
-#ifdef QV_COMPONENT_BITSET_SIZE
-    using ComponentSignature = std::bitset<QV_COMPONENT_BITSET_SIZE>;
-    constexpr size_t componentBitsetSize = QV_COMPONENT_BITSET_SIZE;
-#else
-    using ComponentSignature = std::bitset<64>;
-    constexpr size_t componentBitsetSize = 64;
-#endif
+            // Reserves a row for handle, its components must then be constructed by the caller
+            size_t pushRow(EntityHandle handle) {
+                if (count == chunks.size() * chunkCapacity) {
+                    chunks.push_back(static_cast<std::byte*>(::operator new(chunkBytes, std::align_val_t{alignment})));
+                }
 
-    using EntityHandle = size_t;
+                handles(count / chunkCapacity)[count % chunkCapacity] = handle;
+                return count++;
+            }
 
-    template<typename Component>
-    struct Registrar {
-        static inline ComponentSignature signature;
-        static inline size_t signatureBit;
-        static inline std::vector<Component> components;
-        static inline std::map<EntityHandle, size_t> handleMap;
-        static inline std::map<size_t, EntityHandle> reverseMap;
+            // Fills the row, whose components must already be destroyed or relocated, with the last row. Returns
+            // the handle of the moved entity
+            EntityHandle eraseRow(size_t row) {
+                auto last = count - 1;
+                auto movedHandle = handle(last);
+                if (row != last) {
+                    for (size_t column = 0; column < columns.size(); column++) {
+                        columns[column].relocate(component(column, row), component(column, last));
+                    }
+                    handles(row / chunkCapacity)[row % chunkCapacity] = movedHandle;
+                }
 
-        static void addComponent(Component component, EntityHandle handle) {
-            components.template emplace_back(std::move(component));
-            handleMap.template emplace(handle, components.size() - 1);
-            reverseMap.template emplace(components.size() - 1, handle);
-        }
+                count--;
+                if (count == (chunks.size() - 1) * chunkCapacity) {
+                    ::operator delete(chunks.back(), std::align_val_t{alignment});
+                    chunks.pop_back();
+                }
 
-        static void createComponent(EntityHandle handle) {
-            addComponent(Component{}, handle);
+                return movedHandle;
+            }
+
+            void invalidateSystems() {
+                for (auto descriptor : systems) {
+                    descriptor->invalidateComponentList();
+                }
+            }
+
+            ComponentSignature signature;
+            std::vector<size_t> columnOf; // Column of each component ID, npos when absent
+            std::vector<ComponentInfo> columns;
+            std::vector<size_t> columnOffsets;
+            std::vector<std::byte*> chunks;
+            std::vector<SystemDescriptor*> systems;
+            size_t alignment;
+            size_t chunkCapacity;
+            size_t chunkBytes;
+            size_t count = 0;
+        private:
+            size_t layoutChunk(size_t capacity) {
+                columnOffsets.clear();
+                size_t offset = capacity * sizeof(EntityHandle);
+                for (auto& info : columns) {
+                    offset = (offset + info.alignment - 1) / info.alignment * info.alignment;
+                    columnOffsets.push_back(offset);
+                    offset += capacity * info.size;
+                }
+
+                return offset;
+            }
+        };
+
+        // Value-initialized to no archetype, as entities without components aren't stored in one
+        struct EntityLocation {
+            Archetype* archetype;
+            size_t row;
+        };
+
+        static ComponentSignature getSignature(EntityHandle handle) {
+            auto archetype = entityLocations[entityIndex(handle)].archetype;
+            return archetype ? archetype->signature : ComponentSignature{};
         }
 
-        static void removeComponent(EntityHandle handle) {
-            auto index = handleMap.at(handle);
-            std::swap(components.back(), components.at(index));
-            auto otherHandle = reverseMap.at(components.size() - 1);
-            handleMap.at(otherHandle) = index;
-            reverseMap.at(index) = otherHandle;
+        static Archetype* getArchetype(ComponentSignature signature) {
+            if (signature.none()) return nullptr;
+            if (auto it = archetypeLookup.find(signature); it != archetypeLookup.end()) {
+                return it->second;
+            }
+
+            auto& archetype = archetypes.emplace_back(signature, componentInfos);
+            for (auto& descriptor : systems) {
+                if (compareSignatures(signature, descriptor)) {
+                    archetype.systems.push_back(&descriptor);
+                    descriptor.insertArchetype(&archetype);
+                }
+            }
 
-            components.pop_back();
-            handleMap.erase(handle);
-            reverseMap.erase(components.size());
+            archetypeLookup.emplace(signature, &archetype);
+            return &archetype;
         }
 
-        static Component& getComponent(EntityHandle handle) {
-            return components.at(handleMap.at(handle));
+        // Moves the entity's components into target, default-constructing ones it gains and destroying ones it loses
+        static void moveEntity(EntityHandle handle, Archetype* target) {
+            auto& location = entityLocations[entityIndex(handle)];
+            auto source = location.archetype;
+            if (source == target) return;
+
+            size_t row = 0;
+            if (target) {
+                row = target->pushRow(handle);
+                target->signature.forEachBit([&](size_t bit) {
+                    auto column = target->columnOf[bit];
+                    if (source && source->signature.test(bit)) {
+                        target->columns[column].relocate(target->component(column, row), source->component(source->columnOf[bit], location.row));
+                    } else {
+                        target->columns[column].construct(target->component(column, row));
+                    }
+                });
+                target->invalidateSystems();
+            }
+
+            if (source) {
+                source->signature.forEachBit([&](size_t bit) {
+                    if (!(target && target->signature.test(bit))) {
+                        auto column = source->columnOf[bit];
+                        source->columns[column].destroy(source->component(column, location.row));
+                    }
+                });
+
+                auto movedHandle = source->eraseRow(location.row);
+                entityLocations[entityIndex(movedHandle)].row = location.row;
+                source->invalidateSystems();
+            }
+
+            location = EntityLocation{target, row};
         }
+
+        static inline std::vector<ComponentInfo> componentInfos;
+        static inline std::deque<Archetype> archetypes;
+        static inline std::unordered_map<ComponentSignature, Archetype*, ComponentSignature::Hash> archetypeLookup;
+        static inline std::vector<EntityLocation> entityLocations = std::vector<EntityLocation>(1); // Slot 0 is the null handle
+#endif
+
+        template<typename, typename, typename, bool>
+        friend class BasicSystem;
+        friend class CommandBuffer;
     };
 
-    class World {
+    // Records structural changes to apply later with World::flush(), so they can be made while iterating a system.
+    // Component values are moved into a linear arena of storageBlockBytes blocks, which is kept between flushes along
+    // with the command list, so a buffer reused every frame stops allocating. Created entities get a reserved handle
+    // right away, see World::reserveEntity(), and become entities with their components at the flush
+    class CommandBuffer {
     public:
-        template<typename Component, typename... Components>
-        static void registerComponent() {
-            Registrar<Component>::signature = ComponentSignature{};
-            Registrar<Component>::signature.set(componentId);
-            Registrar<Component>::signatureBit = componentId;
-            destructors.push_back(&Registrar<Component>::removeComponent);
-            systemDescriptors.template emplace_back();
+        CommandBuffer()=default;
+        CommandBuffer(const CommandBuffer&)=delete;
+        CommandBuffer& operator=(const CommandBuffer&)=delete;
 
-            componentId++;
-            if constexpr (sizeof...(Components) != 0) {
-                registerComponent<Components...>();
+        ~CommandBuffer() {
+            clear();
+        }
+
+        // Not allowed in a ParallelCommandBuffer, whose merge can't make the handle deterministic
+        EntityHandle createEntity() {
+            assert(!keyed && "Reserve handles for entities created in a parallel loop before starting it");
+            auto handle = World::reserveEntity();
+            push(Command::Kind::Create, handle, 0, nullptr, nullptr, nullptr);
+            return handle;
+        }
+
+        void destroyEntity(EntityHandle handle) {
+            push(Command::Kind::Destroy, handle, 0, nullptr, [](EntityHandle handle, void*) {
+                World::destroyEntity(handle);
+            }, nullptr);
+        }
+
+        // Replaces the component's value if the entity already has it by the flush
+        template<typename Component>
+        void addComponent(EntityHandle handle, Component component = {}) {
+            auto payload = std::construct_at(static_cast<Component*>(allocate(sizeof(Component), alignof(Component))), std::move(component));
+            push(Command::Kind::Component, handle, Registrar<Component>::signatureBit, payload, [](EntityHandle handle, void* payload) {
+                auto& component = *static_cast<Component*>(payload);
+                if (World::hasComponent<Component>(handle)) {
+                    World::getComponent<Component>(handle) = std::move(component);
+                } else {
+                    World::addComponent<Component>(handle, std::move(component));
+                }
+            }, [](void* payload) {
+                std::destroy_at(static_cast<Component*>(payload));
+            });
+        }
+
+        // Ignored if the entity doesn't have the component by the flush
+        template<typename Component>
+        void removeComponent(EntityHandle handle) {
+            push(Command::Kind::Component, handle, Registrar<Component>::signatureBit, nullptr, [](EntityHandle handle, void*) {
+                if (World::hasComponent<Component>(handle)) {
+                    World::removeComponent<Component>(handle);
+                }
+            }, nullptr);
+        }
+
+        // Drops every command without applying it. Entities it created are destroyed as soon as they materialize
+        void clear() {
+            for (auto& command : commands) {
+                if (command.kind == Command::Kind::Create) {
+                    World::cancelReservation(command.handle);
+                }
             }
+            destroyPayloads();
+            release();
         }
 
-        static EntityHandle createEntity() {
-            entitySignatures.emplace(EntityHandle{entityId}, ComponentSignature{});
-            entitySystemDescriptors.emplace(EntityHandle{entityId}, std::set<SystemDescriptor*>{});
-            return entityId++;
+        [[nodiscard]] bool empty() const {
+            return commands.empty();
         }
 
-        static void destroyEntity(EntityHandle handle) {
-            ComponentSignature& signature = entitySignatures.at(handle);
-            for (size_t bit = 0; bit < signature.size(); bit++) {
-                if (signature.test(bit)) {
-                    destructors.at(bit)(handle);
+        [[nodiscard]] size_t size() const {
+            return commands.size();
+        }
+    private:
+        struct Command {
+            enum class Kind : uint8_t { Create, Component, Destroy };
+
+            Kind kind;
+            size_t component; // Signature bit, component commands are applied grouped by component
+            EntityHandle handle;
+            void* payload;
+            void (*apply)(EntityHandle handle, void* payload);
+            void (*destroy)(void* payload);
+        };
+
+        void push(Command::Kind kind, EntityHandle handle, size_t component, void* payload,
+                  void (*apply)(EntityHandle, void*), void (*destroy)(void*)) {
+            commands.push_back(Command{kind, component, handle, payload, apply, destroy});
+        }
+
+        // Commands on one component commute with those on others, so batching by component keeps the outcome while
+        // applying each registrar's changes back to back. Destroys go last, letting earlier commands on the entity run.
+        // Batches are formed with a counting sort, which keeps recorded order within each batch
+        void apply() {
+            auto batchOf = [](const Command& command) {
+                return command.kind == Command::Kind::Component ? command.component + 1 : 0;
+            };
+
+            batchStarts.assign(2, 0);
+            for (auto& command : commands) {
+                if (command.kind == Command::Kind::Destroy) continue;
+                auto batch = batchOf(command);
+                if (batch + 2 > batchStarts.size()) {
+                    batchStarts.resize(batch + 2, 0);
                 }
+                batchStarts[batch + 1]++;
             }
 
-            for (const auto descriptor : entitySystemDescriptors.at(handle)) {
-                descriptor->set->erase(handle);
-                descriptor->regenerateComponentList();
+            std::partial_sum(batchStarts.begin(), batchStarts.end(), batchStarts.begin());
+            auto destroyStart = batchStarts.back();
+            order.resize(commands.size());
+            for (size_t index = 0; index < commands.size(); index++) {
+                auto& command = commands[index];
+                order[command.kind == Command::Kind::Destroy ? destroyStart++ : batchStarts[batchOf(command)]++] = index;
             }
 
-            entitySystemDescriptors.erase(handle);
-            entitySignatures.erase(handle);
+            for (auto index : order) {
+                auto& command = commands[index];
+                if (command.apply && World::isAlive(command.handle)) {
+                    command.apply(command.handle, command.payload);
+                }
+            }
+            destroyPayloads();
+            release();
         }
 
-        template<typename Component>
-        static void addComponent(EntityHandle handle) {
-            entitySignatures.at(handle).set(Registrar<Component>::signatureBit);
-            Registrar<Component>::createComponent(handle);
-
-            std::ranges::for_each(
-                systemDescriptors.at(Registrar<Component>::signatureBit)
-                | std::views::filter([handle](auto& descriptor){
-                    return World::compareSignatures(entitySignatures.at(handle), descriptor.signature);
-                }),
-                [handle](auto& descriptor) {
-                    descriptor.set->insert(handle);
-                    descriptor.regenerateComponentList();
-                    World::entitySystemDescriptors.at(handle).template emplace(&descriptor);
+        void destroyPayloads() {
+            for (auto& command : commands) {
+                if (command.destroy) {
+                    command.destroy(command.payload);
                 }
-            );
+            }
         }
 
-        template<typename Component>
-        static void removeComponent(EntityHandle handle) {
-            std::ranges::for_each(
-                systemDescriptors.at(Registrar<Component>::signatureBit)
-                | std::views::filter([handle](auto& descriptor){
-                    return World::compareSignatures(entitySignatures.at(handle), descriptor.signature);
-                }),
-                [handle](auto& descriptor) {
-                    descriptor.set->erase(handle);
-                    descriptor.regenerateComponentList();
-                    World::entitySystemDescriptors.at(handle).erase(&descriptor);
+        // Empties the buffer without destroying payloads, for commands another buffer applied and cleared
+        void release() {
+            commands.clear();
+            arenaBlock = 0;
+            arenaOffset = 0;
+        }
+
+        void* allocate(size_t size, size_t alignment) {
+            while (arenaBlock < arenaBlocks.size()) {
+                auto& block = arenaBlocks[arenaBlock];
+                auto base = reinterpret_cast<uintptr_t>(block.bytes.get());
+                auto offset = (base + arenaOffset + alignment - 1) / alignment * alignment - base;
+                if (offset + size <= block.size) {
+                    arenaOffset = offset + size;
+                    return block.bytes.get() + offset;
                 }
-            );
 
-            entitySignatures.at(handle).reset(Registrar<Component>::signatureBit);
-            Registrar<Component>::removeComponent(handle);
+                arenaBlock++;
+                arenaOffset = 0;
+            }
+
+            arenaBlocks.emplace_back(std::max(storageBlockBytes, size + alignment));
+            return allocate(size, alignment);
         }
 
-        template<typename Component, typename... Components>
-        static ComponentSignature generateSignature() {
-            if constexpr (sizeof...(Components) > 0) {
-                return generateSignature<Components...>() | Registrar<Component>::signature;
-            } else {
-                return Registrar<Component>::signature;
+        struct ArenaBlock {
+            explicit ArenaBlock(size_t size) : bytes{std::make_unique<std::byte[]>(size)}, size{size} {}
+
+            std::unique_ptr<std::byte[]> bytes;
+            size_t size;
+        };
+
+        std::vector<Command> commands;
+        std::vector<size_t> batchStarts; // Kept with order between flushes so applying doesn't allocate either
+        std::vector<size_t> order;
+        std::vector<ArenaBlock> arenaBlocks;
+        size_t arenaBlock = 0; // Block currently being filled
+        size_t arenaOffset = 0;
+        bool keyed = false; // Owned by a ParallelCommandBuffer
+
+        friend class World;
+        friend class ParallelCommandBuffer;
+    };
+
+    // One CommandBuffer per thread of a pool, so a parallel loop can record changes without synchronization. Each
+    // call to getBuffer() tags the commands that follow with a (system, pass, chunk) key, and the flush merges every
+    // thread's commands sorted by key. Chunks are keyed by their first index in the loop, so the merged order is the
+    // order a serial loop would have recorded in, however the pool happened to split and steal the range, and the
+    // world ends up the same for any thread count. Creating entities is the exception, as their handles would depend
+    // on the order threads got to reserve them, so it isn't allowed: reserve their handles on one thread before the
+    // loop instead. Only the pool's own threads may record, and threads outside any pool share slot 0 with the thread
+    // that dispatched the loop
+    class ParallelCommandBuffer {
+    public:
+        explicit ParallelCommandBuffer(ThreadPool& pool = ThreadPool::getDefault()) : pool{&pool}, slots(pool.size()) {
+            for (auto& slot : slots) {
+                slot.buffer.keyed = true;
+            }
+        }
+
+        // The pool whose threads may record, which System::parallelForEach runs its loop on
+        [[nodiscard]] ThreadPool& getPool() const {
+            return *pool;
+        }
+
+        // The calling thread's buffer, with the commands recorded into it from now on ordered under this key
+        CommandBuffer& getBuffer(size_t system, size_t pass, size_t chunk) {
+            auto current = ThreadPool::getCurrentPool();
+            assert((!current || current == pool) && "Commands must be recorded from the pool the buffer was made for");
+            auto& slot = slots[current ? ThreadPool::getThreadIndex() : 0];
+            slot.segments.push_back(Segment{system, pass, chunk, slot.buffer.size(), 0, 0});
+            return slot.buffer;
+        }
+
+        // Drops every thread's commands without applying them
+        void clear() {
+            for (auto& slot : slots) {
+                slot.buffer.clear();
+                slot.segments.clear();
             }
         }
 
+        [[nodiscard]] bool empty() const {
+            return std::ranges::all_of(slots, [](const Slot& slot) { return slot.buffer.empty(); });
+        }
     private:
-        struct SystemDescriptor {
-            ComponentSignature signature;
-            std::set<EntityHandle>* set{nullptr};
-            std::function<void()> regenerateComponentList;
+        // A run of one thread's commands recorded under one key
+        struct Segment {
+            size_t system;
+            size_t pass;
+            size_t chunk;
+            size_t first;
+            size_t last; // Filled in by apply(), as is slot
+            size_t slot;
         };
 
-        static bool compareSignatures(ComponentSignature entity, ComponentSignature system) {
-            return (entity & system) == system;
-        }
+        struct alignas(64) Slot {
+            CommandBuffer buffer;
+            std::vector<Segment> segments;
+        };
 
-        static inline size_t componentId = 0;
-        static inline size_t entityId = 1; // Uses ID 0 for a null handle
+        // Concatenates the segments in key order into merged, which applies and destroys every payload, then releases
+        // the thread buffers that held them
+        void apply() {
+            segments.clear();
+            for (size_t index = 0; index < slots.size(); index++) {
+                auto& slot = slots[index];
+                for (size_t next = 1; next <= slot.segments.size(); next++) {
+                    auto segment = slot.segments[next - 1];
+                    segment.last = next < slot.segments.size() ? slot.segments[next].first : slot.buffer.size();
+                    segment.slot = index;
+                    segments.push_back(segment);
+                }
+            }
+
+            std::ranges::sort(segments, [](const Segment& a, const Segment& b) {
+                return std::tie(a.system, a.pass, a.chunk, a.slot, a.first) < std::tie(b.system, b.pass, b.chunk, b.slot, b.first);
+            });
+
+            for (auto& segment : segments) {
+                auto& commands = slots[segment.slot].buffer.commands;
+                merged.commands.insert(merged.commands.end(), commands.begin() + segment.first, commands.begin() + segment.last);
+            }
+            merged.apply();
+
+            for (auto& slot : slots) {
+                slot.buffer.release();
+                slot.segments.clear();
+            }
+        }
 
-        static inline std::vector<std::function<void(EntityHandle)>> destructors;
-        static inline std::vector<std::vector<SystemDescriptor>> systemDescriptors;
-        static inline std::map<EntityHandle, ComponentSignature> entitySignatures;
-        static inline std::map<EntityHandle, std::set<SystemDescriptor*>> entitySystemDescriptors;
+        ThreadPool* pool;
+        std::vector<Slot> slots; // Indexed by ThreadPool::getThreadIndex()
+        std::vector<Segment> segments; // Kept between flushes like merged
+        CommandBuffer merged;
 
-        template<typename...>
-        friend class System;
+        friend class World;
     };
 
-    template<typename... Components>
-    class System {
+    inline void World::flush(CommandBuffer& buffer) {
+        materializeReserved();
+        buffer.apply();
+    }
+
+    inline void World::flush(ParallelCommandBuffer& buffer) {
+        materializeReserved();
+        buffer.apply();
+    }
+
+    inline void World::flush() {
+        flush(getCommandBuffer());
+    }
+
+    inline CommandBuffer& World::getCommandBuffer() {
+        static CommandBuffer buffer;
+        return buffer;
+    }
+
+    // Systems are declared through the System and Group aliases below, which sort their parameters into these lists.
+    // An owning system keeps its required components packed at the front of their registrars, see Group
+    template<typename Required, typename Excluded, typename Optionals, bool Owning>
+    class BasicSystem;
+
+    template<typename... Components, typename... Excluded, typename... Optionals, bool Owning>
+    class BasicSystem<ComponentList<Components...>, ComponentList<Excluded...>, ComponentList<Optionals...>, Owning> {
+        static_assert(sizeof...(Components) > 0, "Systems need at least one required component");
     public:
         static void registerSystem() {
             if (registered) return;
 
-            auto signature = World::generateSignature<Components...>();
+            systemIndex = World::systems.size();
+            auto signature = getSignature();
+            auto exclusion = getExclusion();
+#ifndef QV_ARCHETYPE_STORAGE
+            auto& descriptor = World::systems.emplace_back(
+                    signature, exclusion, insertEntity, eraseEntity, refreshEntity, invalidateComponentList
+            );
+
+            size_t firstBit = 0;
+            while (!signature.test(firstBit)) {
+                firstBit++;
+            }
+            World::ownedDescriptors.at(firstBit).push_back(&descriptor);
+
             for (size_t bit = 0; bit < signature.size(); bit++) {
                 if (signature.test(bit)) {
-                    World::systemDescriptors.at(bit).template emplace_back(signature, &entities, regenerateComponentList);
+                    World::systemDescriptors.at(bit).push_back(&descriptor);
+                }
+            }
+
+            exclusion.forEachBit([&descriptor](size_t bit) {
+                World::excludingDescriptors.at(bit).push_back(&descriptor);
+            });
+            (World::optionalDescriptors.at(Registrar<Optionals>::signatureBit).push_back(&descriptor), ...);
+
+            if constexpr (Owning) {
+                for (auto bit : {Registrar<Components>::signatureBit...}) {
+                    assert(!World::componentOwners.at(bit) && "A component can only be owned by one group");
+                    World::componentOwners.at(bit) = &descriptor;
                 }
             }
+#else
+            auto& descriptor = World::systems.emplace_back(signature, exclusion, insertArchetype, invalidateComponentList);
+            for (auto& archetype : World::archetypes) {
+                if (World::compareSignatures(archetype.signature, descriptor)) {
+                    archetype.systems.push_back(&descriptor);
+                    insertArchetype(&archetype);
+                }
+            }
+            dirty = true;
+#endif
             registered = true;
         }
 
-        static std::vector<std::tuple<Components&..., EntityHandle>>& getComponents() {
+        // A constant expression when every component has a static ID
+        static constexpr ComponentSignature getSignature() {
+            return World::generateSignature<Components...>();
+        }
+
+        // Components an entity must not have to be part of the system
+        static constexpr ComponentSignature getExclusion() {
+            return World::generateSignature<Excluded...>();
+        }
+
+        // Required and optional components the system declares const
+        static constexpr ComponentSignature getReadSignature() {
+            return (ComponentSignature{} | ... | (std::is_const_v<Components> ? Registrar<Components>::signature : ComponentSignature{}))
+                 | (ComponentSignature{} | ... | (std::is_const_v<Optionals> ? Registrar<Optionals>::signature : ComponentSignature{}));
+        }
+
+        // Required and optional components the system may modify
+        static constexpr ComponentSignature getWriteSignature() {
+            return (ComponentSignature{} | ... | (std::is_const_v<Components> ? ComponentSignature{} : Registrar<Components>::signature))
+                 | (ComponentSignature{} | ... | (std::is_const_v<Optionals> ? ComponentSignature{} : Registrar<Optionals>::signature));
+        }
+
+        // Rebuilds the list first if it was invalidated since the last call
+        // Optional components follow the required ones in each tuple
+        static std::vector<std::tuple<ComponentReference<Components>..., OptionalReference<Optionals>..., EntityHandle>>& getComponents() {
+#ifndef QV_ARCHETYPE_STORAGE
+            if (displaced > entities.size() / reorderFraction) {
+                restoreOrder();
+            }
+#endif
+            if (dirty) {
+                regenerateComponentList();
+            }
+
             return componentList;
         }
 
+        // Calls function(ComponentReference<Components>..., OptionalReference<Optionals>..., EntityHandle) for each
+        // entity like a loop over getComponents(), spread over the default thread pool in pieces of grainSize entities.
+        // Calls run concurrently, so function must not add or remove components or entities
+        template<typename Function>
+        static void parallelForEach(Function&& function, size_t grainSize = 0) {
+            auto& components = getComponents();
+            ThreadPool::getDefault().parallelFor(components.size(), grainSize, [&components, &function](size_t begin, size_t end) {
+                for (size_t index = begin; index < end; index++) {
+                    std::apply(function, components[index]);
+                }
+            });
+        }
+
+        // Like parallelForEach on the pool of commands, also passing function the calling thread's buffer in commands as
+        // its first argument. Commands are keyed by this system and the first entity of each piece, so flushing commands
+        // gives the same world as a serial loop would have
+        template<typename Function>
+        static void parallelForEach(ParallelCommandBuffer& commands, Function&& function, size_t grainSize = 0) {
+            auto& components = getComponents();
+            auto pass = passes++;
+            commands.getPool().parallelFor(components.size(), grainSize, [&components, &commands, &function, pass](size_t begin, size_t end) {
+                auto& buffer = commands.getBuffer(systemIndex, pass, begin);
+                for (size_t index = begin; index < end; index++) {
+                    std::apply(function, std::tuple_cat(std::tie(buffer), components[index]));
+                }
+            });
+        }
+
+#ifndef QV_ARCHETYPE_STORAGE
+        // Calls function(ComponentSpan<Components>..., ComponentSpan<Optionals>..., std::span<const EntityHandle>) for
+        // each run of entities whose components are contiguous in every registrar, letting the loop body be vectorized.
+        // Entities are visited in the same order as getComponents(), and a run is cut wherever any registrar's indices
+        // stop being consecutive. An optional component's span is empty when no entity in the run has it
+        template<typename Function>
+        static void forEachChunk(Function&& function) {
+            if (displaced > entities.size() / reorderFraction) {
+                restoreOrder();
+            }
+
+            auto& handles = entities.handles();
+            size_t start = 0;
+            while (start < handles.size()) {
+                auto first = ComponentIndices{Registrar<Components>::entities.index(handles[start])...};
+                auto optionalFirst = OptionalIndices{findIndex<Optionals>(handles[start])...};
+                auto length = getRunLength(handles, start, first, optionalFirst, std::index_sequence_for<Components...>{},
+                                           std::index_sequence_for<Optionals...>{});
+
+                forwardChunk(function, first, optionalFirst, length, std::span{handles}.subspan(start, length),
+                             std::index_sequence_for<Components...>{}, std::index_sequence_for<Optionals...>{});
+                start += length;
+            }
+        }
+
         static void regenerateComponentList() {
             componentList.clear();
             componentList.reserve(entities.size());
-            std::ranges::copy(entities | std::views::transform(getComponentTuple), std::back_inserter(componentList));
+            std::ranges::copy(entities.handles() | std::views::transform(getComponentTuple), std::back_inserter(componentList));
+            dirty = false;
+        }
+#else
+        // Calls function(std::span<Components>..., std::span<Optionals>..., std::span<const EntityHandle>) once per
+        // matching archetype chunk. An optional component's span is empty when the archetype doesn't store it
+        template<typename Function>
+        static void forEachChunk(Function&& function) {
+            for (auto archetype : archetypes) {
+                for (size_t chunk = 0; chunk < archetype->chunks.size(); chunk++) {
+                    auto length = archetype->chunkSize(chunk);
+                    function(
+                        std::span{archetype->template column<Components>(chunk), length}...,
+                        std::span{archetype->template findColumn<Optionals>(chunk), archetype->template findColumn<Optionals>(chunk) ? length : 0}...,
+                        std::span<const EntityHandle>{archetype->handles(chunk), length}
+                    );
+                }
+            }
         }
+
+        // Walks each matching archetype chunk by chunk, so no per-entity lookups are needed
+        static void regenerateComponentList() {
+            componentList.clear();
+            for (auto archetype : archetypes) {
+                for (size_t chunk = 0; chunk < archetype->chunks.size(); chunk++) {
+                    auto handles = archetype->handles(chunk);
+                    auto columns = std::make_tuple(archetype->template column<Components>(chunk)...);
+                    [[maybe_unused]] auto optionalColumns = std::make_tuple(archetype->template findColumn<Optionals>(chunk)...);
+                    for (size_t index = 0; index < archetype->chunkSize(chunk); index++) {
+                        componentList.emplace_back(
+                            std::get<Components*>(columns)[index]...,
+                            std::get<Optionals*>(optionalColumns) ? std::get<Optionals*>(optionalColumns) + index : nullptr...,
+                            handles[index]
+                        );
+                    }
+                }
+            }
+            dirty = false;
+        }
+#endif
     private:
-        static decltype(auto) getComponentTuple(EntityHandle handle) {
-            return std::make_tuple<std::reference_wrapper<Components>..., EntityHandle>(
-                    std::ref(Registrar<Components>::getComponent(handle))..., EntityHandle{handle}
+        using ComponentTuple = std::tuple<ComponentReference<Components>..., OptionalReference<Optionals>..., EntityHandle>;
+
+#ifndef QV_ARCHETYPE_STORAGE
+        using Primary = std::tuple_element_t<0, std::tuple<Components...>>;
+        using ComponentIndices = std::array<size_t, sizeof...(Components)>;
+        using OptionalIndices = std::array<size_t, sizeof...(Optionals)>; // npos for entities without the component
+
+        template<size_t... Index, size_t... OptionalIndex>
+        static size_t getRunLength(const std::vector<EntityHandle>& handles, size_t start, const ComponentIndices& first,
+                                   const OptionalIndices& optionalFirst, std::index_sequence<Index...>,
+                                   std::index_sequence<OptionalIndex...>) {
+            auto limit = std::min({
+                handles.size() - start,
+                (Registrar<Components>::components.blockEnd(first[Index]) - first[Index])...,
+                getOptionalLimit<Optionals>(optionalFirst[OptionalIndex])...
+            });
+
+            size_t length = 1;
+            while (length < limit
+                   && (Owning || ((Registrar<Components>::entities.index(handles[start + length]) == first[Index] + length) && ...))
+                   && ((findIndex<Optionals>(handles[start + length]) == offsetIndex(optionalFirst[OptionalIndex], length)) && ...)) {
+                length++;
+            }
+
+            return length;
+        }
+
+        template<typename Function, size_t... Index, size_t... OptionalIndex>
+        static void forwardChunk(Function& function, const ComponentIndices& first, const OptionalIndices& optionalFirst,
+                                 size_t length, std::span<const EntityHandle> handles, std::index_sequence<Index...>,
+                                 std::index_sequence<OptionalIndex...>) {
+            function(
+                ComponentSpan<Components>{Registrar<Components>::components.span(first[Index], length)}...,
+                getOptionalSpan<Optionals>(optionalFirst[OptionalIndex], length)...,
+                handles
             );
         }
 
-        static inline std::set<EntityHandle> entities;
-        static inline std::vector<std::tuple<Components&..., EntityHandle>> componentList;
+        template<typename Component>
+        static size_t findIndex(EntityHandle handle) {
+            auto& entities = Registrar<Component>::entities;
+            return entities.contains(handle) ? entities.index(handle) : SparseSet::npos;
+        }
+
+        // A run of entities without the component stays a run while they keep not having it
+        static size_t offsetIndex(size_t index, size_t offset) {
+            return index == SparseSet::npos ? index : index + offset;
+        }
+
+        template<typename Component>
+        static size_t getOptionalLimit(size_t first) {
+            return first == SparseSet::npos ? first : Registrar<Component>::components.blockEnd(first) - first;
+        }
+
+        template<typename Component>
+        static ComponentSpan<Component> getOptionalSpan(size_t first, size_t length) {
+            return first == SparseSet::npos ? ComponentSpan<Component>{} : Registrar<Component>::components.span(first, length);
+        }
+
+        static ComponentTuple getComponentTuple(EntityHandle handle) {
+            return ComponentTuple{Registrar<Components>::getComponent(handle)..., Registrar<Optionals>::findComponent(handle)..., handle};
+        }
+
+        // Tuples of references can't be reassigned without writing through them, so the slot is rebuilt instead
+        static void rebindTuple(size_t index, ComponentTuple tuple) {
+            std::destroy_at(&componentList[index]);
+            std::construct_at(&componentList[index], std::move(tuple));
+        }
+
+        // While clean, entities and componentList are kept parallel, so both are appended to and swap-removed
+        // together. Once dirty, only entities is maintained until the next getComponents() rebuilds the list
+        static void insertEntity(EntityHandle handle) {
+            if constexpr (Owning) {
+                (World::moveComponent<Components>(handle, entities.size()), ...);
+            }
+
+            checkOrder(entities.insert(handle));
+            if (dirty) return;
+
+            componentList.push_back(getComponentTuple(handle));
+        }
+
+        static void eraseEntity(EntityHandle handle) {
+            auto index = entities.index(handle);
+            if (!dirty) {
+                if (index != componentList.size() - 1) {
+                    rebindTuple(index, componentList.back());
+                }
+
+                componentList.pop_back();
+            }
+
+            entities.erase(handle);
+            if (index < entities.size()) {
+                checkOrder(index);
+            }
+
+            if constexpr (Owning) {
+                (World::moveComponent<Components>(handle, entities.size()), ...);
+            }
+        }
+
+        static void refreshEntity(EntityHandle handle) {
+            if (!entities.contains(handle)) return;
+
+            auto index = entities.index(handle);
+            checkOrder(index);
+            if (!dirty) {
+                rebindTuple(index, getComponentTuple(handle));
+            }
+        }
+
+        // Entities are kept close to the dense order of the primary (first) component, so iteration streams through
+        // its registrar. Only the entity at index has moved, so comparing it with its neighbours tells whether it was
+        // displaced from that order. Groups are in that order by construction, with member i owning index i of every
+        // owned registrar, so they skip the check and never sort
+        static void checkOrder(size_t index) {
+            if constexpr (Owning) return;
+
+            auto& handles = entities.handles();
+            auto primaryIndex = [&handles](size_t slot) { return Registrar<Primary>::entities.index(handles[slot]); };
+            if ((index > 0 && primaryIndex(index - 1) > primaryIndex(index))
+                || (index + 1 < handles.size() && primaryIndex(index) > primaryIndex(index + 1))) {
+                displaced++;
+            }
+        }
+
+        // Called once more than 1 / reorderFraction of the entities were displaced, so the cost of sorting is spread
+        // over at least that many structural changes
+        static void restoreOrder() {
+            auto& primary = Registrar<Primary>::entities;
+            if (entities.size() * 4 < primary.size()) {
+                entities.sort([&primary](EntityHandle handle) { return primary.index(handle); });
+            } else {
+                entities.sortAs(primary);
+            }
+
+            displaced = 0;
+            invalidateComponentList();
+        }
+
+        static constexpr size_t reorderFraction = 8;
+
+        static inline SparseSet entities;
+        static inline size_t displaced = 0; // Entities moved out of primary component order since the last sort
+#else
+        static void insertArchetype(World::Archetype* archetype) {
+            archetypes.push_back(archetype);
+        }
+
+        static inline std::vector<World::Archetype*> archetypes;
+#endif
+
+        static void invalidateComponentList() {
+            dirty = true;
+            componentList.clear();
+        }
+
+        static inline std::vector<ComponentTuple> componentList;
+        static inline bool dirty = false;
         static inline bool registered = false;
+        static inline size_t systemIndex = 0; // Registration order, orders the commands of parallel loops
+        static inline size_t passes = 0; // Parallel loops run with a ParallelCommandBuffer
+    };
+
+    template<typename... Terms>
+    using System = BasicSystem<RequiredComponents<Terms...>, ExcludedComponents<Terms...>, OptionalComponents<Terms...>, false>;
+
+    // A system owning its required components: each member entity's components sit at the same index in every owned
+    // registrar, all packed ahead of the non-members, so getComponents() and forEachChunk() walk them in parallel. Each
+    // component can be owned by one group at most, and membership changes cost a swap per owned component
+    template<typename... Terms>
+    using Group = BasicSystem<RequiredComponents<Terms...>, ExcludedComponents<Terms...>, OptionalComponents<Terms...>, true>;
+
+    // Runs system updates in the order they were added, except that systems without conflicting component access run
+    // concurrently. Two systems conflict when one writes a component the other reads or writes, and a system runs in
+    // the first stage after every earlier system it conflicts with, so conflicting updates keep their relative order
+    class Scheduler {
+    public:
+        // Schedules SystemType::update(), with the access declared by the system's const and non-const components
+        template<typename SystemType>
+        void add() {
+            add(SystemType::getReadSignature(), SystemType::getWriteSignature(), &SystemType::update);
+        }
+
+        void add(const ComponentSignature& reads, const ComponentSignature& writes, void (*update)()) {
+            size_t stage = 0;
+            for (auto& task : tasks) {
+                if (writes.intersects(task.reads) || writes.intersects(task.writes) || reads.intersects(task.writes)) {
+                    stage = std::max(stage, task.stage + 1);
+                }
+            }
+
+            tasks.push_back(Task{reads, writes, stage});
+            if (stage >= stages.size()) {
+                stages.resize(stage + 1);
+            }
+            stages[stage].push_back(update);
+        }
+
+        // Runs each stage's updates on pool, waiting for a stage to finish before starting the next. Updates run
+        // concurrently, so they must not add or remove components or entities
+        void run(ThreadPool& pool = ThreadPool::getDefault()) const {
+            for (auto& stage : stages) {
+                pool.parallelFor(stage.size(), 1, [&stage](size_t begin, size_t end) {
+                    for (size_t index = begin; index < end; index++) {
+                        stage[index]();
+                    }
+                });
+            }
+        }
+
+        // Updates grouped by the stage they run in, for checking which systems share one
+        [[nodiscard]] const std::vector<std::vector<void (*)()>>& getStages() const {
+            return stages;
+        }
+    private:
+        struct Task {
+            ComponentSignature reads;
+            ComponentSignature writes;
+            size_t stage;
+        };
+
+        std::vector<Task> tasks;
+        std::vector<std::vector<void (*)()>> stages;
     };
 
     class Entity {
@@ -242,7 +2533,7 @@ namespace qv {
         template<typename Component>
         void addComponent() {
             #ifdef QV_DEBUG
-                assert(!Registrar<Component>::handleMap.contains(handle));
+                assert(!World::hasComponent<Component>(handle));
             #endif
             World::addComponent<Component>(handle);
         }
@@ -250,21 +2541,29 @@ namespace qv {
         template<typename Component>
         void removeComponent() {
             #ifdef QV_DEBUG
-                assert(Registrar<Component>::handleMap.contains(handle));
+                assert(World::hasComponent<Component>(handle));
             #endif
             World::removeComponent<Component>(handle);
         }
 
         template<typename Component>
-        Component& getComponent() {
+        ComponentReference<Component> getComponent() {
             #ifdef QV_DEBUG
-                assert(Registrar<Component>::handleMap.contains(handle));
+                assert(World::hasComponent<Component>(handle));
             #endif
-            return Registrar<Component>::getComponent(handle);
+            return World::getComponent<Component>(handle);
         }
     private:
         EntityHandle handle;
     };
 }
 
+template<typename Component, auto... Members>
+struct std::tuple_size<qv::SoAReference<Component, Members...>> : std::integral_constant<size_t, sizeof...(Members)> {};
+
+template<size_t Index, typename Component, auto... Members>
+struct std::tuple_element<Index, qv::SoAReference<Component, Members...>> {
+    using type = std::tuple_element_t<Index, std::tuple<qv::FieldType<Component, Members>&...>>;
+};
+
 #endif //QUIVER_QUIVER_H
\ No newline at end of file